@@ -0,0 +1,153 @@
+/* allocbench.c - heap allocations in init's steady state
+ *
+ * Build (dynamically linked, so malloc can be interposed):
+ *   gcc -O2 -pthread -o allocbench allocbench.c
+ *
+ * Loads a handful of Restart=always services that log a few lines and
+ * exit, one of them structured and one with an EnvironmentFile that is
+ * rewritten while running, and binds a syslog socket that gets a message
+ * every few milliseconds. After a warm-up, init's main loop (poll, output
+ * capture, syslog, log ticks, reaping, restarts, SIGUSR1 stats) runs for
+ * a while with every malloc/calloc/realloc in the process counted,
+ * libc's own included. Reports the restarts and lines handled and the
+ * allocations seen, and exits 1 if there were any.
+ *
+ *   ./allocbench [seconds]       (default 3)
+ */
+
+#define RESTART_BACKOFF_USEC 10000
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+extern void *__libc_memalign(size_t align, size_t n);
+
+static volatile int counting;
+static unsigned long allocs;
+
+void *malloc(size_t n) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(n);
+}
+void *calloc(size_t n, size_t size) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+void *realloc(void *p, size_t n) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, n);
+}
+void *memalign(size_t align, size_t n) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(align, n);
+}
+int posix_memalign(void **p, size_t align, size_t n) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return (*p = __libc_memalign(align, n)) ? 0 : ENOMEM;
+}
+void *aligned_alloc(size_t align, size_t n) {
+    if (counting) __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(align, n);
+}
+
+static const char *confs[] = {
+    "Name=chatty\nExecStart=/bin/sh -c \"echo starting; echo working; sleep 0.05; echo done\"\nRestart=always\n",
+    "Name=quiet\nExecStart=/bin/sleep 0.03\nRestart=always\n",
+    "Name=crashy\nExecStart=/bin/sh -c \"echo oops >&2; exit 3\"\nRestart=always\n",
+    "Name=fields\nExecStart=/bin/sh -c \"echo level=info msg=hello; sleep 0.02\"\nRestart=always\nLogStructured=yes\n",
+    "Name=envfile\nExecStart=/bin/sh -c \"echo $COLOR; sleep 0.02\"\nRestart=always\nEnvironmentFile=%s/env\n",
+};
+#define NCONFS (sizeof(confs)/sizeof(confs[0]))
+
+static void write_env(const char *dir, int n) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/env", dir);
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); exit(1); }
+    fprintf(f, "COLOR=%s\n", n % 2 ? "blue" : "red");
+    fclose(f);
+}
+
+/* init's main loop, minus getty, kmsg and shutdown */
+static void loop(uint64_t until, int syslog_tx, struct sockaddr_un *to) {
+    while (clock_usec(CLOCK_MONOTONIC) < until) {
+        supervise_once(5);
+        static const char msg[] = "<6>allocbench: a syslog line";
+        if (syslog_tx >= 0) sendto(syslog_tx, msg, sizeof(msg) - 1, MSG_DONTWAIT, (struct sockaddr *)to, sizeof(*to));
+    }
+}
+
+int main(int argc, char **argv) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    if (seconds < 1) seconds = 3;
+    char dir[] = "/tmp/allocbench.XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    log_dir = dir;
+    runtime_dir = dir;
+    snprintf(syslog_path, sizeof(syslog_path), "%s/log", dir);
+    /* status lines and stats go to the console, i.e. nowhere */
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+
+    write_env(dir, 0);
+    for (size_t i=0;i<NCONFS;i++) {
+        char text[512];
+        int len = snprintf(text, sizeof(text), confs[i], dir);
+        FILE *f = fmemopen(text, (size_t)len, "r");
+        if (!f) { perror("fmemopen"); return 1; }
+        parse_service(f);
+        fclose(f);
+    }
+    if (nservices != (int)NCONFS) { fprintf(stderr, "loaded %d of %zu services\n", nservices, NCONFS); return 1; }
+    heap_allocs_loaded = heap_allocs;
+
+    if (pipe2(wake_pipe, O_NONBLOCK|O_CLOEXEC) < 0) { perror("pipe2"); return 1; }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sigaction(SIGCHLD, &sa, NULL);
+    sa.sa_handler = sigusr1_handler;
+    sigaction(SIGUSR1, &sa, NULL);
+    open_syslog();
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/syslog.log", dir);
+    syslog_orphan_fd = open(path, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+    int tx = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+    struct sockaddr_un to = { .sun_family = AF_UNIX };
+    snprintf(to.sun_path, sizeof(to.sun_path), "%s", syslog_path);
+
+    /* warm-up: services started, log files opened, first restarts, lazily set up libc state */
+    loop(clock_usec(CLOCK_MONOTONIC) + 500000, tx, &to);
+    kill(getpid(), SIGUSR1);
+    loop(clock_usec(CLOCK_MONOTONIC) + 100000, tx, &to);
+
+    unsigned long restarts0 = 0, heap0 = heap_allocs;
+    for (int i=0;i<nservices;i++) restarts0 += services[i].restarts;
+    counting = 1;
+    uint64_t end = clock_usec(CLOCK_MONOTONIC) + (uint64_t)seconds * 1000000;
+    for (int n = 1; clock_usec(CLOCK_MONOTONIC) < end; n++) {
+        loop(clock_usec(CLOCK_MONOTONIC) + 250000, tx, &to);
+        /* same size, new mtime: rebuilt in place */
+        counting = 0;
+        write_env(dir, n);
+        counting = 1;
+        kill(getpid(), SIGUSR1);
+    }
+    counting = 0;
+
+    unsigned long restarts = 0;
+    for (int i=0;i<nservices;i++) restarts += services[i].restarts;
+    fprintf(stderr, "%d s steady state: %lu restarts, %lu init heap_allocs, %lu malloc calls\n",
+            seconds, restarts - restarts0, heap_allocs - heap0, allocs);
+
+    for (int i=0;i<nservices;i++) {
+        services[i].restart = R_NO;
+        if (services[i].running) kill(-services[i].pid, SIGKILL);
+    }
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) ;
+    char cmd[PATH_MAX + 16];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+    return allocs != 0;
+}
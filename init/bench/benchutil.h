@@ -0,0 +1,92 @@
+/* benchutil.h - scaffolding shared by spawnbench.c and stressbench.c
+ *
+ * Included after "../init.c". Services are the bench binary re-executed
+ * as "<bench> --svc <slots> <idx> <usec>": they live for usec and record
+ * their start and exit times in a slot of a shared file, so the bench can
+ * tell how long init took to notice.
+ */
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <sys/mman.h>
+
+/* one slot per service, written by the service itself */
+typedef struct { uint64_t start, exit; } slot_t;
+
+static slot_t *slots_map(const char *path, int create) {
+    int fd = open(path, create ? O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC : O_RDWR|O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+    if (create && ftruncate(fd, MAX_SVC * sizeof(slot_t)) < 0) { close(fd); return NULL; }
+    void *p = mmap(NULL, MAX_SVC * sizeof(slot_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* the service side: live for usec, then exit 0 */
+static int svc_main(char **argv) {
+    slot_t *slots = slots_map(argv[2], 0);
+    int idx = atoi(argv[3]);
+    if (!slots || idx < 0 || idx >= MAX_SVC) return 1;
+    slots[idx].start = clock_usec(CLOCK_MONOTONIC);
+    usleep((useconds_t)atoi(argv[4]));
+    slots[idx].exit = clock_usec(CLOCK_MONOTONIC);
+    return 0;
+}
+
+/* this binary, to re-execute as the services */
+static void bench_self(char *self, size_t size) {
+    ssize_t n = readlink("/proc/self/exe", self, size - 1);
+    if (n <= 0) { perror("/proc/self/exe"); exit(1); }
+    self[n] = 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* SIGCHLD wakes the loop below through init's own handler */
+static int bench_sigchld(void) {
+    if (pipe2(wake_pipe, O_NONBLOCK|O_CLOEXEC) < 0) { perror("pipe2"); return -1; }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sigaction(SIGCHLD, &sa, NULL);
+    return 0;
+}
+
+/*
+ * init's main loop, minus everything but reaping, until t_end. seen() gets
+ * each exited service's index and the time waitpid() returned it, before
+ * handle_reaped() restarts it.
+ */
+static void bench_reap(uint64_t t_end, void (*seen)(int svc, uint64_t now)) {
+    while (clock_usec(CLOCK_MONOTONIC) < t_end) {
+        struct pollfd pfd = { .fd = wake_pipe[0], .events = POLLIN };
+        char drain[64];
+        if (poll(&pfd, 1, 100) > 0) while (read(wake_pipe[0], drain, sizeof(drain)) > 0) ;
+        if (!need_reap) continue;
+        need_reap = 0;
+        int status;
+        pid_t pid;
+        /* a saturated supervisor never runs out of children to reap */
+        while (clock_usec(CLOCK_MONOTONIC) < t_end && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            uint64_t now = clock_usec(CLOCK_MONOTONIC);
+            int i;
+            for (i=0;i<nservices && services[i].pid != pid;i++) ;
+            if (i < nservices) seen(i, now);
+            handle_reaped(pid, status);
+        }
+    }
+}
+
+/* no more restarts; kill what runs and reap everything */
+static void bench_stop(void) {
+    for (int i=0;i<nservices;i++) {
+        services[i].restart = R_NO;
+        if (services[i].running) kill(services[i].pid, SIGKILL);
+    }
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) ;
+}
+
+#endif
@@ -0,0 +1,346 @@
+/* initsim.c - init's supervisor against simulated processes and a virtual clock
+ *
+ * Build:
+ *   gcc -O2 -pthread -o initsim initsim.c
+ *
+ * Replaces init's sys backend: a spawned service is a fake process that
+ * follows a script, SIGCHLD is an exit event, poll() waits on the virtual
+ * clock, and that clock jumps to the next event. init's own supervise loop
+ * (supervise_once()), start_service(), handle_reaped() (backoff included),
+ * stop_service() (timeouts included) and reap_children() run unchanged, so
+ * a day of supervision takes milliseconds. Scenarios:
+ *   day     200 services for 24 h, then shutdown: daemons, crash loops
+ *           (Restart=on-failure), one-shots, and services that stop slowly
+ *           or not at all on SIGTERM. Start counts and shutdown time are
+ *           checked against what init's backoff and timeouts allow.
+ *   scale   100000 services for 1 h, then shutdown; 1% crash-looping.
+ * A run is deterministic for a given seed.
+ *
+ *   ./initsim [day|scale] [-n services] [-H hours] [-s seed] [-v]
+ *             (-v: keep init's status lines on stdout)
+ */
+
+#define MAX_SVC 100000
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+#define SIM_EPOCH 1767225600000000ULL   /* CLOCK_REALTIME at virtual boot */
+#define SIM_PIDS (2 * MAX_SVC + 64)     /* fake pid table; pid = slot + 2 */
+
+/* what a service's processes do */
+typedef enum { B_DAEMON, B_CRASH, B_ONESHOT, B_SLOW_STOP, B_HANG, B_COUNT } behaviour_t;
+static const char *behaviour_names[B_COUNT] = { "daemon", "crash", "oneshot", "slow-stop", "hang" };
+
+typedef struct {
+    behaviour_t b;
+    uint64_t life;       /* crash, oneshot: usec from start to exit */
+    uint64_t stop;       /* slow-stop: usec from SIGTERM to exit */
+} script_t;
+
+static script_t *script;   /* per service */
+static uint64_t vnow;      /* virtual usec since boot */
+static uint64_t vhold = UINT64_MAX;   /* events after this wait for the next phase */
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t rng_range(uint64_t lo, uint64_t hi) {
+    return lo + rng() % (hi - lo + 1);
+}
+
+/* fake processes */
+enum { P_FREE = 0, P_RUNNING, P_ZOMBIE };
+typedef struct {
+    int state;
+    int svc;
+    int status;          /* wait status once a zombie */
+    unsigned gen;        /* bumped on every reuse; stale events are dropped */
+} proc;
+
+static proc procs[SIM_PIDS];
+static int next_slot;
+
+/* exits scheduled for later, a binary heap on (time, seq) */
+typedef struct { uint64_t t, seq; int slot; unsigned gen; int status; } event;
+static event *heap;
+static size_t nheap, heap_cap;
+static uint64_t seq;
+
+/* zombies waiting for waitpid(-1), oldest first */
+static int *zq;
+static size_t zq_head, zq_tail;
+static unsigned long nevents, nexits;
+
+static int ev_before(const event *a, const event *b) {
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+static void ev_push(uint64_t t, int slot, int status) {
+    if (nheap == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 4096;
+        heap = realloc(heap, heap_cap * sizeof(event));
+        if (!heap) { perror("realloc"); exit(1); }
+    }
+    event e = { t, seq++, slot, procs[slot].gen, status };
+    size_t i = nheap++;
+    while (i && ev_before(&e, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static event ev_pop(void) {
+    event top = heap[0], last = heap[--nheap];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= nheap) break;
+        if (c + 1 < nheap && ev_before(&heap[c + 1], &heap[c])) c++;
+        if (!ev_before(&heap[c], &last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/* the process exits now; the kernel would send SIGCHLD */
+static void proc_exit(int slot, int status) {
+    proc *p = &procs[slot];
+    p->state = P_ZOMBIE;
+    p->status = status;
+    zq[zq_tail++ % SIM_PIDS] = slot;
+    nexits++;
+    need_reap = 1;
+}
+
+/* fire the next event if it is due by `until`; returns 1 if a process exited */
+static int ev_fire(uint64_t until) {
+    if (until > vhold) until = vhold;
+    while (nheap && heap[0].t <= until) {
+        event e = ev_pop();
+        if (e.t > vnow) vnow = e.t;   /* held events arrive late */
+        nevents++;
+        proc *p = &procs[e.slot];
+        if (p->state != P_RUNNING || p->gen != e.gen) continue;
+        proc_exit(e.slot, e.status);
+        return 1;
+    }
+    return 0;
+}
+
+static pid_t sim_spawn(service *s) {
+    for (int tries = 0; procs[next_slot].state != P_FREE; tries++) {
+        if (tries == SIM_PIDS) { errno = EAGAIN; return -1; }
+        next_slot = (next_slot + 1) % SIM_PIDS;
+    }
+    int slot = next_slot;
+    next_slot = (next_slot + 1) % SIM_PIDS;
+    proc *p = &procs[slot];
+    p->state = P_RUNNING;
+    p->svc = (int)(s - services);
+    p->gen++;
+    script_t *sc = &script[p->svc];
+    if (sc->b == B_CRASH) ev_push(vnow + sc->life, slot, 1 << 8);
+    else if (sc->b == B_ONESHOT) ev_push(vnow + sc->life, slot, 0);
+    return slot + 2;
+}
+
+static proc *sim_proc(pid_t pid) {
+    if (pid < 0) pid = -pid;   /* process group = its leader here */
+    if (pid < 2 || pid >= SIM_PIDS + 2) return NULL;
+    return &procs[pid - 2];
+}
+
+static int sim_kill(pid_t pid, int sig) {
+    proc *p = sim_proc(pid);
+    if (!p || p->state == P_FREE) { errno = ESRCH; return -1; }
+    if (p->state != P_RUNNING || sig == 0) return 0;
+    int slot = (int)(p - procs);
+    script_t *sc = &script[p->svc];
+    if (sig == SIGKILL) {
+        proc_exit(slot, SIGKILL);
+    } else if (sig == SIGTERM || sig == SIGINT) {
+        if (sc->b == B_SLOW_STOP) ev_push(vnow + sc->stop, slot, 0);
+        else if (sc->b != B_HANG) proc_exit(slot, sig);
+    }
+    return 0;
+}
+
+static void sim_release(int slot, int *status) {
+    if (status) *status = procs[slot].status;
+    procs[slot].state = P_FREE;
+}
+
+static pid_t sim_waitpid(pid_t pid, int *status, int flags) {
+    for (;;) {
+        if (pid == -1) {
+            while (zq_head != zq_tail) {
+                int slot = zq[zq_head++ % SIM_PIDS];
+                if (procs[slot].state != P_ZOMBIE) continue;   /* reaped by pid */
+                sim_release(slot, status);
+                return slot + 2;
+            }
+        } else {
+            proc *p = sim_proc(pid);
+            if (!p || p->state == P_FREE) { errno = ECHILD; return -1; }
+            if (p->state == P_ZOMBIE) {
+                sim_release((int)(p - procs), status);
+                return pid;
+            }
+        }
+        if (flags & WNOHANG) return 0;
+        if (!ev_fire(UINT64_MAX)) { errno = ECHILD; return -1; }
+    }
+}
+
+/* like nanosleep(): cut short by the first SIGCHLD */
+static void sim_sleep(uint64_t usec) {
+    uint64_t until = vnow + usec;
+    if (!ev_fire(until)) vnow = until;
+}
+
+static uint64_t sim_clock(clockid_t id) {
+    return id == CLOCK_REALTIME ? SIM_EPOCH + vnow : vnow;
+}
+
+/* no fd is ever ready: the wait ends at the first exit, or times out */
+static int sim_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms) {
+    (void)fds; (void)nfds;
+    sim_sleep((uint64_t)timeout_ms * 1000);
+    return 0;
+}
+
+static const sys_ops sys_sim = { sim_spawn, sim_kill, sim_waitpid, sim_sleep, sim_clock, sim_poll };
+
+/* init's own supervise loop until `until`; no exit after it is delivered */
+static void sim_run(uint64_t until) {
+    vhold = until;
+    while (!terminate && vnow < until) supervise_once(1000);
+    vhold = UINT64_MAX;
+}
+
+static void add_service(int i, behaviour_t b) {
+    char conf[256];
+    snprintf(conf, sizeof(conf), "Name=%s-%d\nExecStart=/sbin/sim-%s\nStandardOutput=null\n%s",
+             behaviour_names[b], i, behaviour_names[b], b == B_DAEMON ? "" : "Restart=on-failure\n");
+    FILE *f = fmemopen(conf, strlen(conf), "r");
+    if (!f) { perror("fmemopen"); exit(1); }
+    parse_service(f);
+    fclose(f);
+    script_t *sc = &script[nservices - 1];
+    sc->b = b;
+    if (b == B_CRASH) sc->life = rng_range(1000000, 600000000);
+    if (b == B_ONESHOT) sc->life = rng_range(1000000, 60000000);
+    if (b == B_SLOW_STOP) sc->stop = rng_range(100000, 3000000);
+}
+
+/* real time, for reporting; clock_usec() is virtual now */
+static uint64_t wall_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static double wall_msec(uint64_t since) { return (double)(wall_usec() - since) / 1e3; }
+
+int main(int argc, char **argv) {
+    const char *scenario = "day";
+    int n = -1, verbose = 0;
+    double hours = -1;
+    uint64_t seed = 1;
+    if (argc > 1 && argv[1][0] != '-') { scenario = argv[1]; argc--; argv++; }
+    int opt;
+    while ((opt = getopt(argc, argv, "n:H:s:v")) != -1) {
+        switch (opt) {
+        case 'n': n = atoi(optarg); break;
+        case 'H': hours = atof(optarg); break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "usage: initsim [day|scale] [-n services] [-H hours] [-s seed] [-v]\n");
+            return 2;
+        }
+    }
+    int day = strcmp(scenario, "day") == 0;
+    if (!day && strcmp(scenario, "scale") != 0) { fprintf(stderr, "unknown scenario %s\n", scenario); return 2; }
+    if (n < 0) n = day ? 200 : 100000;
+    if (hours < 0) hours = day ? 24 : 1;
+    if (n > MAX_SVC) n = MAX_SVC;
+    rng_state = seed ? seed : 1;
+
+    /* services get init's environment; keep it small */
+    clearenv();
+    setenv("PATH", DEFAULT_PATH, 1);
+    if (!verbose && !freopen("/dev/null", "w", stdout)) return 1;
+    sys = &sys_sim;
+    script = calloc((size_t)n + 1, sizeof(script_t));
+    zq = malloc(SIM_PIDS * sizeof(int));
+    if (!script || !zq) { perror("malloc"); return 1; }
+
+    uint64_t w0 = wall_usec();
+    for (int i=0;i<n;i++) {
+        behaviour_t b = B_DAEMON;
+        if (day) {
+            static const behaviour_t mix[20] = { B_CRASH, B_CRASH, B_ONESHOT, B_SLOW_STOP, B_HANG };
+            b = mix[i % 20];
+        } else if (i % 100 == 0) {
+            b = B_CRASH;
+        }
+        add_service(i, b);
+    }
+    double load_ms = wall_msec(w0);
+
+    uint64_t w1 = wall_usec();
+    /* the first pass of the loop starts them, as in init */
+    uint64_t horizon = (uint64_t)(hours * 3600e6);
+    sim_run(horizon);
+    double run_ms = wall_msec(w1);
+
+    /* shutdown as init does it: stop services one after another */
+    uint64_t w2 = wall_usec(), v2 = vnow;
+    for (int i=0;i<nservices;i++) stop_service(&services[i]);
+    uint64_t shutdown_us = vnow - v2;
+    double shutdown_ms = wall_msec(w2);
+
+    /* checks: what init's 1 s backoff and 5 s stop timeout allow */
+    int bad = 0;
+    unsigned long starts[B_COUNT] = { 0 }, count[B_COUNT] = { 0 };
+    uint64_t shutdown_max = 0;
+    for (int i=0;i<nservices;i++) {
+        script_t *sc = &script[i];
+        unsigned long st = services[i].restarts + 1UL;
+        starts[sc->b] += st;
+        count[sc->b]++;
+        unsigned long lo = 1, hi = 1;
+        if (sc->b == B_CRASH) {
+            /* each cycle is life plus the backoff */
+            lo = (unsigned long)(horizon / (sc->life + RESTART_BACKOFF_USEC));
+            hi = lo + 1;
+        }
+        if (st < lo || st > hi) {
+            if (bad++ < 10) fprintf(stderr, "MISMATCH %s: %lu starts, expected %lu..%lu\n", services[i].name, st, lo, hi);
+        }
+        if (sc->b == B_SLOW_STOP) shutdown_max += (sc->stop + 99999) / 100000 * 100000;
+        if (sc->b == B_HANG) shutdown_max += 5000000;
+    }
+    if (shutdown_us > shutdown_max) {
+        fprintf(stderr, "MISMATCH shutdown took %.1f s, expected at most %.1f s\n", shutdown_us / 1e6, shutdown_max / 1e6);
+        bad++;
+    }
+
+    fprintf(stderr, "scenario %s: %d services, %.1f h virtual, seed %llu\n", scenario, nservices, hours, (unsigned long long)seed);
+    for (int b=0;b<B_COUNT;b++)
+        if (count[b]) fprintf(stderr, "  %-10s %7lu services %10lu starts\n", behaviour_names[b], count[b], starts[b]);
+    fprintf(stderr, "  events %lu, exits %lu\n", nevents, nexits);
+    fprintf(stderr, "  shutdown %.1f s virtual\n", shutdown_us / 1e6);
+    fprintf(stderr, "  wall: load %.0f ms, run %.0f ms, shutdown %.0f ms\n", load_ms, run_ms, shutdown_ms);
+    fprintf(stderr, "%s\n", bad ? "FAIL" : "ok");
+    return bad ? 1 : 0;
+}
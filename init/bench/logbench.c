@@ -0,0 +1,95 @@
+/* logbench.c - log ingestion throughput of the init log collector
+ *
+ * Build:
+ *   gcc -O2 -pthread -o logbench logbench.c
+ *
+ * Feeds synthetic service output (lines of 20-200 bytes) through the same
+ * code init uses for captured stdout/stderr and reports MB/s of CPU time,
+ * i.e. per core. The logfile is /dev/null so only init's own work counts.
+ *
+ *   ./logbench [megabytes]
+ */
+
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, size_t bytes, double secs) {
+    printf("%-28s %10.1f MB/s\n", what, (double)bytes / (1024.0*1024.0) / secs);
+}
+
+/* run one newline scanner over buf repeatedly */
+static void bench_scan(const char *what, size_t (*fn)(const char *, size_t, uint32_t *),
+                       const char *buf, size_t len, int rounds) {
+    static uint32_t offs[LOG_SCAN_MAX];
+    size_t lines = 0;
+    double t0 = cpu_seconds();
+    for (int r=0;r<rounds;r++)
+        for (size_t off=0; off<len; off+=LOG_SCAN_MAX)
+            lines += fn(buf+off, len-off < LOG_SCAN_MAX ? len-off : LOG_SCAN_MAX, offs);
+    report(what, len * (size_t)rounds, cpu_seconds() - t0);
+    if (lines == 0) printf("(no lines?)\n");
+}
+
+/* full path: split, timestamp, stage, write */
+static void bench_ingest(const char *what, service *s, const char *buf, size_t len, int rounds) {
+    double t0 = cpu_seconds();
+    for (int r=0;r<rounds;r++) {
+        for (size_t off=0; off<len; off+=16384) {
+            log_stamp();
+            log_output(s, buf+off, len-off < 16384 ? len-off : 16384);
+        }
+        log_flush();
+    }
+    report(what, len * (size_t)rounds, cpu_seconds() - t0);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    size_t len = 8u << 20;
+    int rounds = (int)(mb / 8) > 0 ? (int)(mb / 8) : 1;
+    char *buf = malloc(len);
+    if (!buf) { perror("malloc"); return 1; }
+    srand(1);
+    for (size_t i=0; i<len; ) {
+        size_t n = 20 + (size_t)(rand() % 180);
+        for (size_t k=0; k<n && i<len; k++) buf[i++] = (char)('a' + rand() % 26);
+        if (i < len) buf[i++] = '\n';
+    }
+
+    printf("%zu MB per test\n", len * (size_t)rounds >> 20);
+    bench_scan("scan: scalar", scan_newlines_scalar, buf, len, rounds);
+#if defined(__x86_64__)
+    bench_scan("scan: sse2", scan_newlines_sse2, buf, len, rounds);
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) bench_scan("scan: avx2", scan_newlines_avx2, buf, len, rounds);
+#endif
+
+    service *s = &services[nservices++];
+    memset(s, 0, sizeof(*s));
+    static char partial[LOG_LINE_MAX];
+    s->name = "bench";
+    s->logfile = "/dev/null";
+    s->partial = partial;
+    s->logfd = -1;
+    s->outr = s->outw = -1;
+    s->timestamps = 1;
+
+    scan_newlines = scan_newlines_scalar;
+    bench_ingest("ingest: scalar", s, buf, len, rounds);
+    select_scanner();
+    bench_ingest("ingest: best scanner", s, buf, len, rounds);
+    s->timestamps = 0;
+    bench_ingest("ingest: no timestamps", s, buf, len, rounds);
+    s->timestamps = 1;
+    s->rl_burst = 1u << 31;
+    s->rl_interval = 1;
+    s->rl_tokens = s->rl_burst;
+    bench_ingest("ingest: rate limited", s, buf, len, rounds);
+    return 0;
+}
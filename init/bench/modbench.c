@@ -0,0 +1,180 @@
+/* modbench.c - boot-time module loading, serial against the worker pool
+ *
+ * Build:
+ *   gcc -O2 -pthread -o modbench modbench.c
+ *
+ * Writes a modules.dep for a made-up tree of 60 modules (a few core
+ * libraries, subsystems on top of them, drivers on top of those) and
+ * has init's modules_start() / modules_wait() load all the drivers with
+ * 1, 2, 4 and 8 workers. finit_module() is replaced by a stub that takes
+ * 5..40 ms per module, as probing hardware does, and checks that every
+ * dependency of a module finished loading before the module started.
+ * Reports the wall time per worker count against the sum of load times.
+ * Then fails one core library and checks that exactly the modules above
+ * it are failed as dependents (none as a cycle) and the rest still load,
+ * for all the drivers and for one driver on its own.
+ *
+ *   ./modbench
+ */
+
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+#define NCORE 5
+#define NSUB 15
+#define NDRV 40
+#define NMOD (NCORE + NSUB + NDRV)
+
+static struct { char name[16]; int cost_ms; int deps[NMOD], ndeps; uint64_t start, end; } tree[NMOD];
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+static int order_errors;
+static int fail_idx = -1;   /* this one's load fails */
+
+static int tree_find(const char *name) {
+    for (int i=0;i<NMOD;i++) if (strcmp(tree[i].name, name)==0) return i;
+    return -1;
+}
+
+/* stands in for finit_module() */
+static int fake_load(const char *path) {
+    char name[64];
+    mod_name(path, strlen(path), name, sizeof(name));
+    int i = tree_find(name);
+    if (i < 0) return -ENOENT;
+    pthread_mutex_lock(&tree_lock);
+    tree[i].start = clock_usec(CLOCK_MONOTONIC);
+    for (int k=0;k<tree[i].ndeps;k++)
+        if (!tree[tree[i].deps[k]].end) order_errors++;
+    pthread_mutex_unlock(&tree_lock);
+    usleep((useconds_t)tree[i].cost_ms * 1000);
+    if (i == fail_idx) return -EINVAL;
+    pthread_mutex_lock(&tree_lock);
+    tree[i].end = clock_usec(CLOCK_MONOTONIC);
+    pthread_mutex_unlock(&tree_lock);
+    return 0;
+}
+
+static void add_dep(int i, int d) {
+    for (int k=0;k<tree[i].ndeps;k++) if (tree[i].deps[k] == d) return;
+    tree[i].deps[tree[i].ndeps++] = d;
+    /* modules.dep lists the closure */
+    for (int k=0;k<tree[d].ndeps;k++) add_dep(i, tree[d].deps[k]);
+}
+
+static void make_tree(const char *root) {
+    srand(1);
+    for (int i=0;i<NMOD;i++) {
+        snprintf(tree[i].name, sizeof(tree[i].name), i < NCORE ? "core%d" : i < NCORE + NSUB ? "sub%d" : "drv%d", i);
+        tree[i].cost_ms = 5 + rand() % 36;
+        if (i >= NCORE + NSUB) {
+            add_dep(i, NCORE + rand() % NSUB);
+            if (rand() % 2) add_dep(i, NCORE + rand() % NSUB);
+        } else if (i >= NCORE) {
+            add_dep(i, rand() % NCORE);
+        }
+    }
+    struct utsname u;
+    uname(&u);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, u.release);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/modules.dep", root, u.release);
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); exit(1); }
+    for (int i=0;i<NMOD;i++) {
+        fprintf(f, "kernel/%s/%s.ko.zst:", i < NCORE ? "lib" : "drivers", tree[i].name);
+        /* closure, nearest first, as depmod writes it (modprobe loads it
+         * back to front) */
+        for (int k=0;k<tree[i].ndeps;k++) {
+            int d = tree[i].deps[k];
+            fprintf(f, " kernel/%s/%s.ko.zst", d < NCORE ? "lib" : "drivers", tree[d].name);
+        }
+        fputc('\n', f);
+    }
+    fclose(f);
+}
+
+static void reset(int workers) {
+    for (int i=0;i<NMOD;i++) tree[i].start = tree[i].end = 0;
+    memset(mods.mod, 0, sizeof(mods.mod));
+    mods.n = mods.nworkers = 0;
+    module_workers = workers;
+}
+
+/* load the list with fail_idx failing; returns mismatches in what failed how */
+static int check_failure(int workers) {
+    int errors = 0;
+    reset(workers);
+    modules_start();
+    modules_wait();
+    for (int i=0;i<mods.n;i++) {
+        int t = tree_find(mods.mod[i].name), above = 0;
+        for (int k=0;k<tree[t].ndeps;k++) above |= tree[t].deps[k] == fail_idx;
+        int want = t == fail_idx ? -EINVAL : above ? MOD_ERR_DEP : 0;
+        if (mods.mod[i].err != want && errors++ < 10)
+            printf("%s: err %d, expected %d\n", mods.mod[i].name, mods.mod[i].err, want);
+    }
+    return errors;
+}
+
+int main(void) {
+    char root[] = "/tmp/modbench.XXXXXX";
+    if (!mkdtemp(root)) { perror("mkdtemp"); return 1; }
+    make_tree(root);
+    mods.root = root;
+    mods.load = fake_load;
+    /* the drivers, as a modules-load.d list would name them */
+    static char list[MAX_LINE];
+    size_t used = 0;
+    for (int i=NCORE+NSUB;i<NMOD;i++)
+        used += (size_t)snprintf(list + used, sizeof(list) - used, "%s%s", used ? "," : "", tree[i].name);
+    boot_modules = list;
+    /* the machine's own lists name modules the made-up tree does not have */
+    con.level = CON_ERR;
+
+    /* what the drivers pull in */
+    int need[NMOD] = { 0 }, nneed = 0, total = 0;
+    for (int i=NCORE+NSUB;i<NMOD;i++) {
+        need[i] = 1;
+        for (int k=0;k<tree[i].ndeps;k++) need[tree[i].deps[k]] = 1;
+    }
+    for (int i=0;i<NMOD;i++) if (need[i]) { nneed++; total += tree[i].cost_ms; }
+    printf("%d modules, %d ms of loading in all\n", nneed, total);
+    printf("%8s %10s %8s\n", "workers", "wall ms", "speedup");
+    static const int workers[] = { 1, 2, 4, 8 };
+    for (size_t w=0;w<sizeof(workers)/sizeof(workers[0]);w++) {
+        reset(workers[w]);
+        uint64_t t0 = clock_usec(CLOCK_MONOTONIC);
+        modules_start();
+        modules_wait();
+        double ms = (double)(clock_usec(CLOCK_MONOTONIC) - t0) / 1000.0;
+        int loaded = 0;
+        for (int i=0;i<NMOD;i++) loaded += tree[i].end != 0;
+        if (loaded != mods.n) printf("only %d of %d modules loaded\n", loaded, mods.n);
+        printf("%8d %10.1f %7.1fx\n", mods.nworkers, ms, (double)total / ms);
+    }
+
+    /* a core library fails: what sits on it fails with it, the rest loads;
+     * also for one driver alone, where the failure is only seen behind a
+     * subsystem still waiting on the same library */
+    fail_idx = 0;
+    int fail_errors = check_failure(4);
+    for (int i=NCORE+NSUB;i<NMOD;i++) {
+        if (tree[i].ndeps < 2 || tree[tree[i].deps[0]].deps[0] != fail_idx) continue;
+        snprintf(list, sizeof(list), "%s", tree[i].name);
+        fail_errors += check_failure(1);
+        break;
+    }
+    printf("failing %s: %s\n", tree[fail_idx].name, fail_errors ? "FAIL" : "dependents failed, rest loaded");
+
+    char path[PATH_MAX];
+    struct utsname u;
+    uname(&u);
+    snprintf(path, sizeof(path), "%s/%s/modules.dep", root, u.release);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", root, u.release);
+    rmdir(path);
+    rmdir(root);
+    if (order_errors) printf("%d modules started before a dependency finished\n", order_errors);
+    return order_errors != 0 || fail_errors != 0;
+}
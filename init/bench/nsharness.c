@@ -0,0 +1,368 @@
+/* nsharness.c - run init in its own namespaces against synthetic services
+ *
+ * Build:
+ *   gcc -O2 -o nsharness nsharness.c
+ *
+ * Starts an init binary as PID 1 of a new user+PID+mount namespace (no
+ * root needed where unprivileged user namespaces are allowed), as a user
+ * instance on a temporary services/log/runtime directory, with generated
+ * services of these kinds:
+ *   crash   exits 1 after a short while; Restart=on-failure
+ *   slow    takes a while to stop on SIGTERM
+ *   flood   writes log lines as fast as init takes them
+ *   fork    keeps spawning short-lived orphans for init to reap
+ *   idle    just sleeps
+ * Services report their start and exit times on a FIFO; init's status
+ * lines (stdout) give the matching start/reap times. After the run, init
+ * gets SIGTERM. Results go to stdout as one JSON object:
+ *   boot_us      init started -> every service has started once
+ *   reap_us      service exit -> init reports it reaped (distribution)
+ *   restart_us   crash exit -> same service running again (distribution)
+ *   shutdown_us  SIGTERM -> init exited
+ *
+ *   ./nsharness [-i ../init] [-t seconds] [-c crash] [-s slow] [-f flood]
+ *               [-b fork] [-d idle] [-k]      (-k: keep the temp directory)
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#define MAX_SVC 128           /* init's own limit */
+#define PID_SLOTS 65536
+
+enum { K_CRASH, K_SLOW, K_FLOOD, K_FORK, K_IDLE, K_COUNT };
+static const char *kind_names[K_COUNT] = { "crash", "slow", "flood", "fork", "idle" };
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/*
+ * Synthetic services: "nsharness --svc <kind> <idx> <fifo>". Events are
+ * "S|X <idx> <pid> <usec>" lines, short enough to be atomic on the FIFO.
+ */
+static int ev_fd = -1;
+static int svc_idx;
+static volatile sig_atomic_t svc_term = 0;
+
+static void svc_event(char what) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "%c %d %d %llu\n", what, svc_idx, getpid(),
+                     (unsigned long long)now_usec());
+    if (write(ev_fd, line, (size_t)n) < 0) { /* harness gone */ }
+}
+
+static void svc_on_term(int sig) { (void)sig; svc_term = 1; }
+
+static int svc_main(char **argv) {
+    int kind = 0;
+    while (kind < K_COUNT && strcmp(argv[2], kind_names[kind])) kind++;
+    svc_idx = atoi(argv[3]);
+    ev_fd = open(argv[4], O_WRONLY|O_NONBLOCK|O_CLOEXEC);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = svc_on_term;
+    sigaction(SIGTERM, &sa, NULL);
+    svc_event('S');
+    struct timespec ms = { 0, 1000000 };
+    switch (kind) {
+    case K_CRASH:
+        /* 20-70 ms of "work", then fail */
+        for (int i = 20 + svc_idx * 7 % 50; i > 0 && !svc_term; i--) nanosleep(&ms, NULL);
+        svc_event('X');
+        return 1;
+    case K_SLOW:
+        while (!svc_term) pause();
+        /* 200 ms to wind down */
+        for (int i=0;i<200;i++) nanosleep(&ms, NULL);
+        break;
+    case K_FLOOD: {
+        char line[128];
+        unsigned long n = 0;
+        while (!svc_term) {
+            int len = snprintf(line, sizeof(line), "flood %d line %lu level=info msg=\"synthetic output\"\n", svc_idx, n++);
+            if (write(1, line, (size_t)len) < 0 && errno != EINTR) break;
+        }
+        break;
+    }
+    case K_FORK:
+        /* orphans: the middle child exits at once, so the grandchild is
+         * reparented to init, which has to reap it */
+        while (!svc_term) {
+            pid_t p = fork();
+            if (p == 0) {
+                if (fork() == 0) { nanosleep(&ms, NULL); _exit(0); }
+                _exit(0);
+            }
+            if (p > 0) waitpid(p, NULL, 0);
+            nanosleep(&ms, NULL);
+        }
+        break;
+    default:
+        while (!svc_term) pause();
+        break;
+    }
+    svc_event('X');
+    return 0;
+}
+
+/* latency samples, in usec */
+typedef struct { uint64_t *v; size_t n, cap; } samples;
+
+static void sample_add(samples *s, uint64_t v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+        if (!s->v) { perror("realloc"); exit(1); }
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_dist(const char *name, samples *s, int last) {
+    qsort(s->v, s->n, sizeof(uint64_t), cmp_u64);
+    printf("  \"%s\": {\"n\": %zu", name, s->n);
+    if (s->n) {
+        static const struct { const char *name; double q; } pct[] = {
+            { "p50", 0.50 }, { "p99", 0.99 }, { "p999", 0.999 }, { "max", 1.0 },
+        };
+        for (size_t i=0;i<sizeof(pct)/sizeof(pct[0]);i++) {
+            size_t k = (size_t)(pct[i].q * (double)(s->n - 1));
+            printf(", \"%s\": %llu", pct[i].name, (unsigned long long)s->v[k]);
+        }
+    }
+    printf("}%s\n", last ? "" : ",");
+}
+
+static int rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 5 && strcmp(argv[1], "--svc")==0) return svc_main(argv);
+
+    const char *init_path = "../init";
+    int seconds = 5, keep = 0;
+    int count[K_COUNT] = { 8, 4, 2, 2, 4 };
+    int opt;
+    while ((opt = getopt(argc, argv, "i:t:c:s:f:b:d:k")) != -1) {
+        switch (opt) {
+        case 'i': init_path = optarg; break;
+        case 't': seconds = atoi(optarg); break;
+        case 'c': count[K_CRASH] = atoi(optarg); break;
+        case 's': count[K_SLOW] = atoi(optarg); break;
+        case 'f': count[K_FLOOD] = atoi(optarg); break;
+        case 'b': count[K_FORK] = atoi(optarg); break;
+        case 'd': count[K_IDLE] = atoi(optarg); break;
+        case 'k': keep = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-i init] [-t sec] [-c n] [-s n] [-f n] [-b n] [-d n] [-k]\n", argv[0]);
+            return 2;
+        }
+    }
+    char init_abs[PATH_MAX], self[PATH_MAX];
+    if (!realpath(init_path, init_abs)) { perror(init_path); return 1; }
+    ssize_t sl = readlink("/proc/self/exe", self, sizeof(self)-1);
+    if (sl <= 0) { perror("/proc/self/exe"); return 1; }
+    self[sl] = 0;
+
+    /* temp tree: services/, log/, run/, events FIFO */
+    char dir[] = "/tmp/nsharness.XXXXXX", path[PATH_MAX + 64], fifo[PATH_MAX + 64];
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    static const char *sub[] = { "services", "log", "run" };
+    for (int i=0;i<3;i++) { snprintf(path, sizeof(path), "%s/%s", dir, sub[i]); mkdir(path, 0755); }
+    snprintf(fifo, sizeof(fifo), "%s/events", dir);
+    if (mkfifo(fifo, 0600) < 0) { perror("mkfifo"); return 1; }
+    int ev = open(fifo, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+
+    int nsvc = 0, kind_of[MAX_SVC];
+    for (int k=0;k<K_COUNT;k++) {
+        for (int i=0;i<count[k] && nsvc < MAX_SVC;i++, nsvc++) {
+            snprintf(path, sizeof(path), "%s/services/%s-%d.conf", dir, kind_names[k], nsvc);
+            FILE *f = fopen(path, "w");
+            if (!f) { perror(path); return 1; }
+            fprintf(f, "Name=%s-%d\nExecStart=%s --svc %s %d %s\n", kind_names[k], nsvc, self, kind_names[k], nsvc, fifo);
+            if (k == K_CRASH) fprintf(f, "Restart=on-failure\n");
+            if (k == K_FLOOD) fprintf(f, "LogRateLimitBurst=0\n");
+            fclose(f);
+            kind_of[nsvc] = k;
+        }
+    }
+
+    int out[2], sync_pipe[2];
+    if (pipe2(out, O_CLOEXEC) < 0 || pipe2(sync_pipe, O_CLOEXEC) < 0) { perror("pipe"); return 1; }
+    uint64_t t_boot = now_usec();
+    struct clone_args ca;
+    memset(&ca, 0, sizeof(ca));
+    ca.flags = CLONE_NEWUSER|CLONE_NEWPID|CLONE_NEWNS;
+    ca.exit_signal = SIGCHLD;
+    pid_t init_pid = (pid_t)syscall(SYS_clone3, &ca, sizeof(ca));
+    if (init_pid < 0) { perror("clone3"); return 1; }
+    if (init_pid == 0) {
+        /* PID 1: wait for our uid/gid maps, then give ourselves a /proc */
+        char c;
+        close(sync_pipe[1]);
+        if (read(sync_pipe[0], &c, 1) != 1) _exit(1);
+        if (mount(NULL, "/", NULL, MS_REC|MS_PRIVATE, NULL) < 0 ||
+            mount("proc", "/proc", "proc", MS_NOSUID|MS_NODEV|MS_NOEXEC, NULL) < 0) {
+            perror("mount /proc");
+            _exit(1);
+        }
+        dup2(out[1], 1);
+        dup2(out[1], 2);
+        char sdir[PATH_MAX + 16], ldir[PATH_MAX + 16], rdir[PATH_MAX + 16];
+        snprintf(sdir, sizeof(sdir), "%s/services", dir);
+        snprintf(ldir, sizeof(ldir), "%s/log", dir);
+        snprintf(rdir, sizeof(rdir), "%s/run", dir);
+        char *args[] = { "init", "--user", "--services-dir", sdir, "--log-dir", ldir, "--runtime-dir", rdir, NULL };
+        char *envp[] = { "PATH=/usr/bin:/bin", "HOME=/", NULL };
+        execve(init_abs, args, envp);
+        perror("execve init");
+        _exit(127);
+    }
+    /* map our uid and gid to root inside */
+    char map[64];
+    int fd;
+    snprintf(path, sizeof(path), "/proc/%d/setgroups", init_pid);
+    if ((fd = open(path, O_WRONLY)) >= 0) { if (write(fd, "deny", 4) < 0) perror(path); close(fd); }
+    static const char *maps[] = { "uid_map", "gid_map" };
+    for (int i=0;i<2;i++) {
+        snprintf(path, sizeof(path), "/proc/%d/%s", init_pid, maps[i]);
+        int n = snprintf(map, sizeof(map), "0 %u 1\n", i == 0 ? (unsigned)getuid() : (unsigned)getgid());
+        if ((fd = open(path, O_WRONLY)) < 0 || write(fd, map, (size_t)n) != n) { perror(path); return 1; }
+        close(fd);
+    }
+    if (write(sync_pipe[1], "x", 1) != 1) return 1;
+    close(sync_pipe[1]); close(sync_pipe[0]); close(out[1]);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+    /* per-service state; exit times keyed by (namespace) pid */
+    uint64_t first_start[MAX_SVC] = { 0 }, last_exit[MAX_SVC] = { 0 };
+    static struct { int pid; uint64_t usec; } exited[PID_SLOTS];
+    int started = 0;
+    uint64_t boot_us = 0, starts = 0, reaps = 0;
+    samples reap = { 0 }, restart = { 0 };
+
+    char obuf[65536], ebuf[4096];
+    size_t olen = 0, elen = 0;
+    uint64_t t_stop = t_boot + (uint64_t)seconds * 1000000, t_term = 0, shutdown_us = 0;
+    int status = 0, done = 0, eof = 0;
+    while (!done) {
+        struct pollfd pfd[2] = { { .fd = out[0], .events = POLLIN }, { .fd = ev, .events = POLLIN } };
+        uint64_t now = now_usec();
+        if (!t_term && now >= t_stop) {
+            t_term = now;
+            kill(init_pid, SIGTERM);
+        }
+        int timeout = t_term ? 100 : (int)((t_stop - now) / 1000) + 1;
+        poll(pfd, 2, timeout);
+        uint64_t t = now_usec();
+        /* FIFO first: a service's exit event precedes init's line about it */
+        ssize_t r;
+        while ((r = read(ev, ebuf + elen, sizeof(ebuf) - elen - 1)) > 0) {
+            elen += (size_t)r;
+            char *line = ebuf, *nl;
+            while ((nl = memchr(line, '\n', elen - (size_t)(line - ebuf)))) {
+                char what;
+                int idx, pid;
+                unsigned long long usec;
+                *nl = 0;
+                if (sscanf(line, "%c %d %d %llu", &what, &idx, &pid, &usec) == 4 && idx >= 0 && idx < nsvc) {
+                    if (what == 'S') {
+                        if (!first_start[idx]) {
+                            first_start[idx] = usec;
+                            if (++started == nsvc) boot_us = usec - t_boot;
+                        } else if (last_exit[idx] && kind_of[idx] == K_CRASH) {
+                            sample_add(&restart, usec - last_exit[idx]);
+                        }
+                    } else if (what == 'X') {
+                        last_exit[idx] = usec;
+                        exited[pid % PID_SLOTS].pid = pid;
+                        exited[pid % PID_SLOTS].usec = usec;
+                    }
+                }
+                line = nl + 1;
+            }
+            elen -= (size_t)(line - ebuf);
+            memmove(ebuf, line, elen);
+        }
+        while ((r = read(out[0], obuf + olen, sizeof(obuf) - olen - 1)) > 0) {
+            olen += (size_t)r;
+            char *line = obuf, *nl;
+            while ((nl = memchr(line, '\n', olen - (size_t)(line - obuf)))) {
+                char name[128];
+                int pid;
+                *nl = 0;
+                if (sscanf(line, "[init] service %127s exited pid=%d", name, &pid) == 2) {
+                    reaps++;
+                    if (pid > 0 && exited[pid % PID_SLOTS].pid == pid) {
+                        sample_add(&reap, t - exited[pid % PID_SLOTS].usec);
+                        exited[pid % PID_SLOTS].pid = 0;
+                    }
+                } else if (sscanf(line, "[init] started %127s pid=%d", name, &pid) == 2) {
+                    starts++;
+                }
+                line = nl + 1;
+            }
+            olen -= (size_t)(line - obuf);
+            memmove(obuf, line, olen);
+            if (olen == sizeof(obuf) - 1) olen = 0;   /* overlong line */
+        }
+        if (r == 0) eof = 1;
+        if (eof || t_term) {
+            pid_t w = waitpid(init_pid, &status, eof ? 0 : WNOHANG);
+            if (w == init_pid) {
+                shutdown_us = now_usec() - t_term;
+                done = 1;
+            }
+        }
+    }
+
+    uint64_t log_bytes = 0;
+    for (int i=0;i<nsvc;i++) {
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/log/%s-%d.log", dir, kind_names[kind_of[i]], i);
+        if (stat(path, &st) == 0) log_bytes += (uint64_t)st.st_size;
+    }
+    printf("{\n");
+    printf("  \"services\": %d, \"seconds\": %d,\n", nsvc, seconds);
+    printf("  \"kinds\": {");
+    for (int k=0;k<K_COUNT;k++) printf("%s\"%s\": %d", k ? ", " : "", kind_names[k], count[k]);
+    printf("},\n");
+    printf("  \"started_all\": %s, \"boot_us\": %llu,\n", started == nsvc ? "true" : "false", (unsigned long long)boot_us);
+    printf("  \"starts\": %llu, \"reaps\": %llu, \"log_bytes\": %llu,\n",
+           (unsigned long long)starts, (unsigned long long)reaps, (unsigned long long)log_bytes);
+    print_dist("reap_us", &reap, 0);
+    print_dist("restart_us", &restart, 0);
+    printf("  \"shutdown_us\": %llu, \"init_status\": %d\n", (unsigned long long)shutdown_us,
+           WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    printf("}\n");
+
+    if (!keep) nftw(dir, rm_entry, 16, FTW_DEPTH|FTW_PHYS);
+    else fprintf(stderr, "kept %s\n", dir);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/* parsebench.c - service file parser throughput
+ *
+ * Build:
+ *   gcc -O2 -pthread -o parsebench parsebench.c
+ *
+ * Parses a set of representative service files over and over and reports
+ * files/s and MB/s, once from memory (parse_service() alone) and once
+ * from a directory (parse_service_file(), as load_services() does). Both
+ * include the load-time work done per file: argv/envp, credentials and
+ * seccomp compilation.
+ *
+ *   ./parsebench [seconds]
+ *   ./parsebench -w dir      write the files as a fuzzing corpus instead
+ */
+
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+static const struct { const char *name, *text; } samples[] = {
+    { "minimal", "Name=minimal\nExecStart=/bin/true\n" },
+    { "getty",
+      "# login on the first console\n"
+      "Name=getty-tty1\n"
+      "ExecStart=/bin/sh -c \"/bin/login\"\n"
+      "Restart=on-failure\n"
+      "StandardInput=tty\n"
+      "StandardOutput=inherit\n"
+      "TTYPath=/dev/tty1\n" },
+    { "daemon",
+      "Name=httpd\n"
+      "ExecStart=/usr/sbin/httpd -f -p 8080 -h /srv/www\n"
+      "Restart=always\n"
+      "User=root\n"
+      "Environment=LANG=C.UTF-8 \"GREETING=hello world\"\n"
+      "Environment=TZ=UTC\n"
+      "EnvironmentFile=-/etc/default/httpd\n"
+      "LogRateLimitIntervalSec=10\n"
+      "LogRateLimitBurst=500\n"
+      "LogStructured=yes\n"
+      "CoredumpMaxSize=64M\n" },
+    { "sandboxed",
+      "Name=resolver\n"
+      "ExecStart=/usr/sbin/resolver --listen 127.0.0.1:53\n"
+      "Restart=on-failure\n"
+      "PrivateTmp=yes\n"
+      "ProtectSystem=strict\n"
+      "ReadOnlyPaths=/etc -/opt/resolver\n"
+      "SystemCallFilter=@system-service\n"
+      "SystemCallFilter=~@mount @debug\n"
+      "SystemCallErrorNumber=EPERM\n"
+      "CapabilityBoundingSet=CAP_NET_BIND_SERVICE\n"
+      "AmbientCapabilities=CAP_NET_BIND_SERVICE\n"
+      "NoNewPrivileges=yes\n" },
+    { "crlf",
+      "\xEF\xBB\xBFName=edited-on-windows\r\n"
+      "ExecStart=/bin/sleep 3600\r\n"
+      "Restart=always\r\n"
+      "LogTimestamps=no\r\n" },
+};
+#define NSAMPLES (sizeof(samples)/sizeof(samples[0]))
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, unsigned long files, size_t bytes, double secs) {
+    printf("%-20s %10.0f files/s %8.1f MB/s\n", what, (double)files / secs,
+           (double)bytes / (1024.0*1024.0) / secs);
+}
+
+static int write_corpus(const char *dir) {
+    mkdir(dir, 0755);
+    for (size_t i=0;i<NSAMPLES;i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.conf", dir, samples[i].name);
+        FILE *f = fopen(path, "w");
+        if (!f) { perror(path); return 1; }
+        fputs(samples[i].text, f);
+        fclose(f);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2 && strcmp(argv[1], "-w")==0) return write_corpus(argv[2]);
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    if (seconds <= 0) seconds = 2;
+
+    /* from memory */
+    unsigned long files = 0;
+    size_t bytes = 0;
+    double t0 = cpu_seconds(), t;
+    do {
+        for (size_t i=0;i<NSAMPLES;i++) {
+            size_t len = strlen(samples[i].text);
+            FILE *f = fmemopen((void *)samples[i].text, len, "r");
+            if (!f) { perror("fmemopen"); return 1; }
+            parse_service(f);
+            fclose(f);
+            if (nservices != 1) { fprintf(stderr, "%s did not load\n", samples[i].name); return 1; }
+            unload_last_service();
+            files++;
+            bytes += len;
+        }
+    } while ((t = cpu_seconds() - t0) < seconds);
+    report("parse_service", files, bytes, t);
+
+    /* from files */
+    char dir[] = "/tmp/parsebench.XXXXXX", path[PATH_MAX];
+    if (!mkdtemp(dir) || write_corpus(dir)) { perror("corpus"); return 1; }
+    files = 0;
+    bytes = 0;
+    t0 = cpu_seconds();
+    do {
+        for (size_t i=0;i<NSAMPLES;i++) {
+            snprintf(path, sizeof(path), "%s/%s.conf", dir, samples[i].name);
+            parse_service_file(path);
+            unload_last_service();
+            files++;
+            bytes += strlen(samples[i].text);
+        }
+    } while ((t = cpu_seconds() - t0) < seconds);
+    report("parse_service_file", files, bytes, t);
+
+    for (size_t i=0;i<NSAMPLES;i++) {
+        snprintf(path, sizeof(path), "%s/%s.conf", dir, samples[i].name);
+        unlink(path);
+    }
+    rmdir(dir);
+    return 0;
+}
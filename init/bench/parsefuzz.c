@@ -0,0 +1,93 @@
+/* parsefuzz.c - fuzz target for the service file parser
+ *
+ * Build, libFuzzer:
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -pthread -o parsefuzz parsefuzz.c
+ *   ./parsefuzz corpus/
+ * AFL++ (persistent mode), or a plain replay binary with gcc:
+ *   afl-clang-fast -g -O1 -DPARSEFUZZ_MAIN -pthread -o parsefuzz parsefuzz.c
+ *   afl-fuzz -i corpus -o findings -- ./parsefuzz
+ *   gcc -g -O1 -fsanitize=address -DPARSEFUZZ_MAIN -pthread -o parsefuzz parsefuzz.c
+ *   ./parsefuzz crash-1234 ...       (no arguments: one input on stdin)
+ *
+ * Each input is parsed as one service file by parse_service(), including
+ * the load-time work it does (argv/envp, credentials, seccomp compile),
+ * and then unloaded again, so leaks show up under LeakSanitizer. Inputs
+ * that do load are also checked for the invariants the supervisor relies
+ * on: name and logfile set, argv and envp NULL-terminated.
+ * `./parsebench -w corpus/` writes a starting corpus.
+ */
+
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+static void check_service(const service *s) {
+    if (!s->name || !s->name[0] || strlen(s->name) >= 128) abort();
+    if (!s->logfile || !s->partial) abort();
+    if (!s->execcmd || !s->execcmd[0]) abort();
+    if (s->argv) {
+        int n = 0;
+        while (s->argv[n]) if (++n > MAX_LINE) abort();
+        if (n == 0) abort();
+    }
+    if (s->envp) {
+        int n = 0;
+        while (s->envp[n]) if (!strchr(s->envp[n++], '=')) abort();
+    }
+    if (s->nenvfiles < 0 || s->nenvfiles > ENV_FILES_MAX) abort();
+    if (s->ngroups < 0 || s->ngroups > CRED_GROUPS_MAX) abort();
+    if ((s->nenvfiles && !s->envfiles) || (s->ngroups && !s->groups)) abort();
+    for (int i=0;i<3;i++)
+        if ((s->std[i] == STD_FILE || s->std[i] == STD_APPEND) && (!s->std_path || !s->std_path[i])) abort();
+    if (s->envp && !s->restarts_env) abort();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static int quiet;
+    if (!quiet) {
+        /* parse warnings would drown the fuzzer's own output */
+        quiet = 1;
+        if (!freopen("/dev/null", "w", stdout)) return 0;
+    }
+    if (size == 0) return 0;
+    FILE *f = fmemopen((void *)data, size, "r");
+    if (!f) return 0;
+    int before = nservices;
+    parse_service(f);
+    fclose(f);
+    if (nservices > before) {
+        check_service(&services[nservices-1]);
+        unload_last_service();
+    }
+    return 0;
+}
+
+#ifdef PARSEFUZZ_MAIN
+static size_t read_input(int fd, uint8_t *buf, size_t cap) {
+    size_t len = 0;
+    ssize_t r;
+    while (len < cap && (r = read(fd, buf + len, cap - len)) > 0) len += (size_t)r;
+    return len;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t buf[1 << 20];
+    if (argc > 1) {
+        for (int i=1;i<argc;i++) {
+            int fd = open(argv[i], O_RDONLY|O_CLOEXEC);
+            if (fd < 0) { perror(argv[i]); return 1; }
+            size_t len = read_input(fd, buf, sizeof(buf));
+            close(fd);
+            LLVMFuzzerTestOneInput(buf, len);
+        }
+        return 0;
+    }
+#ifdef __AFL_LOOP
+    while (__AFL_LOOP(10000))
+#endif
+    {
+        size_t len = read_input(0, buf, sizeof(buf));
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    return 0;
+}
+#endif
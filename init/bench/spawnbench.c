@@ -0,0 +1,156 @@
+/* spawnbench.c - spawn and reap cost of init's supervision path
+ *
+ * Build:
+ *   gcc -O2 -pthread -o spawnbench spawnbench.c
+ *
+ * For 10, 100 and 1000 services (Restart=always, each exiting after a
+ * random 1..2*L ms) runs init's own start_service() / SIGCHLD / waitpid /
+ * handle_reaped() path for a few seconds after starting them all and
+ * reports:
+ *   spawn/s      rate of the initial start of all services
+ *   reap         service exit -> waitpid() returned it   (p50/p99/p999 usec)
+ *   restart      service exit -> restarted service running (p50/p99/p999 usec)
+ *   cpu          init's own user+sys time (getrusage), total and per spawn
+ * Services are this binary re-executed; they record their start and exit
+ * times in a shared file. The restart backoff is compiled out.
+ *
+ *   ./spawnbench [seconds] [L]       (defaults: 3 s, 100 ms)
+ */
+
+#define MAX_SVC 1024
+#define RESTART_BACKOFF_USEC 0
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+#include "benchutil.h"
+
+typedef struct { uint64_t *v; size_t n, cap; } samples;
+
+static void sample_add(samples *s, uint64_t v) {
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 4096;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+        if (!s->v) { perror("realloc"); exit(1); }
+    }
+    s->v[s->n++] = v;
+}
+
+static uint64_t pct(samples *s, double q) {
+    return s->n ? s->v[(size_t)(q * (double)(s->n - 1))] : 0;
+}
+
+static double cpu_msec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+           (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+/* the current run, for seen() */
+static slot_t *slots;
+static uint64_t last_exit[MAX_SVC], t_churn;
+static samples reap, restart;
+static unsigned long spawns;
+
+static void seen(int i, uint64_t now) {
+    /* the slot still holds the previous run's start until the restarted
+     * service overwrites it */
+    if (last_exit[i] && slots[i].start > last_exit[i]) sample_add(&restart, slots[i].start - last_exit[i]);
+    /* exits during the initial start wait for all of it */
+    if (slots[i].exit >= t_churn) {
+        sample_add(&reap, now - slots[i].exit);
+        last_exit[i] = slots[i].exit;
+    }
+    spawns++;
+}
+
+static void run(const char *dir, const char *self, int nsvc, int seconds, int life_ms) {
+    char slots_path[256], path[512];
+    snprintf(slots_path, sizeof(slots_path), "%s/slots", dir);
+    slots = slots_map(slots_path, 1);
+    if (!slots) { perror(slots_path); exit(1); }
+
+    nservices = 0;
+    for (int i=0;i<nsvc;i++) {
+        snprintf(path, sizeof(path), "%s/svc%d.conf", dir, i);
+        FILE *f = fopen(path, "w");
+        if (!f) { perror(path); exit(1); }
+        int usec = 1000 + rand() % (2000 * life_ms);
+        fprintf(f, "Name=bench%d\nExecStart=%s --svc %s %d %d\nRestart=always\n", i, self, slots_path, i, usec);
+        fclose(f);
+        parse_service_file(path);
+        unlink(path);
+    }
+    if (nservices != nsvc) { fprintf(stderr, "loaded %d of %d services\n", nservices, nsvc); exit(1); }
+
+    double cpu0 = cpu_msec();
+    uint64_t t0 = clock_usec(CLOCK_MONOTONIC);
+    for (int i=0;i<nservices;i++) start_service(&services[i]);
+    uint64_t t_spawn = clock_usec(CLOCK_MONOTONIC) - t0;
+
+    memset(last_exit, 0, sizeof(last_exit));
+    reap = (samples){ 0 };
+    restart = (samples){ 0 };
+    spawns = (unsigned long)nservices;
+    t_churn = t0 + t_spawn;
+    bench_reap(t_churn + (uint64_t)seconds * 1000000, seen);
+    double cpu = cpu_msec() - cpu0;
+
+    for (int i=0;i<nservices;i++)
+        if (last_exit[i] && slots[i].start > last_exit[i]) sample_add(&restart, slots[i].start - last_exit[i]);
+    bench_stop();
+    for (int i=0;i<nservices;i++) {
+        service *s = &services[i];
+        if (s->outr >= 0) { close(s->outr); close(s->outw); s->outr = s->outw = -1; }
+        if (s->logfd >= 0) close(s->logfd);
+        if (s->idxfd >= 0) close(s->idxfd);
+    }
+    nservices = 0;
+    munmap(slots, MAX_SVC * sizeof(slot_t));
+    unlink(slots_path);
+
+    qsort(reap.v, reap.n, sizeof(uint64_t), cmp_u64);
+    qsort(restart.v, restart.n, sizeof(uint64_t), cmp_u64);
+    fprintf(stderr, "%8d %10.0f %7llu %7llu %7llu %8llu %8llu %8llu %9.0f %8.1f\n",
+            nsvc, (double)nsvc * 1e6 / (double)(t_spawn ? t_spawn : 1),
+            (unsigned long long)pct(&reap, 0.5), (unsigned long long)pct(&reap, 0.99),
+            (unsigned long long)pct(&reap, 0.999),
+            (unsigned long long)pct(&restart, 0.5), (unsigned long long)pct(&restart, 0.99),
+            (unsigned long long)pct(&restart, 0.999),
+            cpu, cpu * 1e3 / (double)spawns);
+    free(reap.v);
+    free(restart.v);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 5 && strcmp(argv[1], "--svc")==0) return svc_main(argv);
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    int life_ms = argc > 2 ? atoi(argv[2]) : 100;
+    if (seconds < 1) seconds = 1;
+    if (life_ms < 1) life_ms = 1;
+
+    char self[PATH_MAX];
+    bench_self(self, sizeof(self));
+    char dir[] = "/tmp/spawnbench.XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    log_dir = dir;
+
+    /* two capture pipe ends per service */
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < 4 * MAX_SVC) {
+        nofile.rlim_cur = nofile.rlim_max < 4 * MAX_SVC ? nofile.rlim_max : 4 * MAX_SVC;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
+    if (bench_sigchld() < 0) return 1;
+    /* start_service() reports every start on stdout */
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    srand(1);
+
+    fprintf(stderr, "%8s %10s %23s %26s %18s\n", "", "", "reap usec", "restart usec", "init cpu");
+    fprintf(stderr, "%8s %10s %7s %7s %7s %8s %8s %8s %9s %8s\n",
+            "services", "spawn/s", "p50", "p99", "p999", "p50", "p99", "p999", "ms", "us/spawn");
+    static const int sizes[] = { 10, 100, 1000 };
+    for (size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) run(dir, self, sizes[i], seconds, life_ms);
+    rmdir(dir);
+    return 0;
+}
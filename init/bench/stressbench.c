@@ -0,0 +1,154 @@
+/* stressbench.c - reap latency on a saturated box, with and without protection
+ *
+ * Build:
+ *   gcc -O2 -pthread -o stressbench stressbench.c
+ *
+ * Runs 50 Restart=always services that exit after a random 10..100 ms
+ * (this binary re-executed; each records its exit time in a shared file,
+ * see benchutil.h) under init's own start_service() / SIGCHLD /
+ * waitpid() / handle_reaped() path, for a few seconds in each setting:
+ *   idle        nothing else running
+ *   loaded      4 busy loops per CPU, and with -m, processes dirtying
+ *               that many MB between them
+ *   protected   the same load, after init's protect_self(): mlockall,
+ *               oom_score_adj -1000 and the -n or -r priority (what
+ *               ratos.nice= / ratos.rtprio= give)
+ * and reports reap latency, service exit -> waitpid() returned it, as
+ * p50/p99/max usec, and the restarts done. The protection needs root.
+ *
+ *   ./stressbench [-t seconds] [-m MB] [-n nice] [-r rtprio]
+ *                 (defaults: 3 s, no memory load, nice -10)
+ */
+
+#define MAX_SVC 64
+#define RESTART_BACKOFF_USEC 0
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+#include "benchutil.h"
+
+#define NSVC 50
+
+/* load: busy loops, and memory dirtied page by page over and over */
+static pid_t hogs[256];
+static int nhogs;
+
+static void hog(size_t bytes) {
+    pid_t pid = fork();
+    if (pid < 0) return;
+    if (pid > 0) { hogs[nhogs++] = pid; return; }
+    char *mem = bytes ? mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+    for (unsigned char v = 0;; v++) {
+        if (mem == MAP_FAILED) continue;
+        for (size_t i=0;i<bytes;i+=4096) mem[i] = (char)v;
+    }
+}
+
+static void hogs_stop(void) {
+    for (int i=0;i<nhogs;i++) kill(hogs[i], SIGKILL);
+    for (int i=0;i<nhogs;i++) waitpid(hogs[i], NULL, 0);
+    nhogs = 0;
+}
+
+/* the current setting, for seen() */
+static slot_t *slots;
+static uint64_t lat[1 << 20];
+static size_t nlat;
+static unsigned long restarts;
+
+static void seen(int i, uint64_t now) {
+    if (slots[i].exit && nlat < sizeof(lat)/sizeof(lat[0])) {
+        lat[nlat++] = now - slots[i].exit;
+        slots[i].exit = 0;
+        restarts++;
+    }
+}
+
+/* one setting, in a process of its own so protection does not carry over */
+static void supervise(const char *label, const char *dir, const char *self, int seconds, int protect) {
+    char slots_path[256];
+    snprintf(slots_path, sizeof(slots_path), "%s/slots", dir);
+    slots = slots_map(slots_path, 1);
+    if (!slots) { perror(slots_path); _exit(1); }
+    log_dir = dir;
+    for (int i=0;i<NSVC;i++) {
+        char text[512];
+        int len = snprintf(text, sizeof(text), "Name=stress%d\nExecStart=%s --svc %s %d %d\nRestart=always\n",
+                           i, self, slots_path, i, 10000 + rand() % 90000);
+        FILE *f = fmemopen(text, (size_t)len, "r");
+        if (!f) _exit(1);
+        parse_service(f);
+        fclose(f);
+    }
+    if (nservices != NSVC) { fprintf(stderr, "loaded %d of %d services\n", nservices, NSVC); _exit(1); }
+    if (protect) protect_self();
+    if (bench_sigchld() < 0) _exit(1);
+
+    for (int i=0;i<nservices;i++) start_service(&services[i]);
+    bench_reap(clock_usec(CLOCK_MONOTONIC) + (uint64_t)seconds * 1000000, seen);
+    bench_stop();
+    unlink(slots_path);
+
+    /* what protect_self() managed to apply */
+    char applied[128] = "";
+    if (protect) {
+        char line[256];
+        long vmlck = 0;
+        FILE *f = fopen("/proc/self/status", "r");
+        while (f && fgets(line, sizeof(line), f))
+            if (strncmp(line, "VmLck:", 6)==0) vmlck = strtol(line + 6, NULL, 10);
+        if (f) fclose(f);
+        int policy = sched_getscheduler(0) & ~SCHED_RESET_ON_FORK;
+        struct sched_param sp;
+        sched_getparam(0, &sp);
+        snprintf(applied, sizeof(applied), "%s, oom_score_adj %s, %s %d", vmlck ? "mlocked" : "not mlocked",
+                 self_protected ? "-1000" : "unchanged", policy == SCHED_FIFO ? "SCHED_FIFO" : "nice",
+                 policy == SCHED_FIFO ? sp.sched_priority : getpriority(PRIO_PROCESS, 0));
+    }
+    qsort(lat, nlat, sizeof(uint64_t), cmp_u64);
+    fprintf(stderr, "%-10s %9lu %9llu %9llu %9llu   %s\n", label, restarts,
+            (unsigned long long)(nlat ? lat[nlat/2] : 0),
+            (unsigned long long)(nlat ? lat[(size_t)(0.99 * (double)(nlat - 1))] : 0),
+            (unsigned long long)(nlat ? lat[nlat-1] : 0), applied);
+    _exit(0);
+}
+
+static void run(const char *label, const char *dir, const char *self, int seconds, int protect) {
+    pid_t pid = fork();
+    if (pid == 0) supervise(label, dir, self, seconds, protect);
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 5 && strcmp(argv[1], "--svc")==0) return svc_main(argv);
+    int seconds = 3, mb = 0;
+    boot_nice = -10;
+    for (int i=1;i+1<argc;i+=2) {
+        if (strcmp(argv[i], "-t")==0) seconds = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-m")==0) mb = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-n")==0) boot_nice = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "-r")==0) boot_rtprio = atoi(argv[i+1]);
+    }
+    if (seconds < 1) seconds = 1;
+
+    char self[PATH_MAX];
+    bench_self(self, sizeof(self));
+    char dir[] = "/tmp/stressbench.XXXXXX";
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+    /* start_service() reports every start on stdout */
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+    srand(1);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nbusy = (int)(ncpu > 0 ? ncpu : 1) * 4;
+    if (nbusy > 128) nbusy = 128;
+    fprintf(stderr, "%d busy loops, %d MB dirtied; reap latency in usec\n", nbusy, mb);
+    fprintf(stderr, "%-10s %9s %9s %9s %9s\n", "", "reaps", "p50", "p99", "max");
+    run("idle", dir, self, seconds, 0);
+    for (int i=0;i<nbusy;i++) hog(0);
+    for (int i=0;i<(mb ? 4 : 0);i++) hog((size_t)mb << 18);
+    run("loaded", dir, self, seconds, 0);
+    run("protected", dir, self, seconds, 1);
+    hogs_stop();
+    rmdir(dir);
+    return 0;
+}
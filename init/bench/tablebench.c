@@ -0,0 +1,131 @@
+/* tablebench.c - memory and scan cost of the service table
+ *
+ * Build:
+ *   gcc -O2 -pthread -o tablebench tablebench.c
+ *
+ * Loads 128, 1024 and 4096 copies of a typical service file through
+ * parse_service() and reports what the table costs:
+ *   record       sizeof(service)
+ *   rss KB       growth of VmRSS over the load (table, strings, argv, envp)
+ *   heap KB      growth of malloc'd bytes over the load
+ *   scan ns      one pass over the table as the supervise loop makes it
+ *                (pid lookup as reaping does, capture fds as poll does),
+ *                per service, with the table evicted from cache between
+ *                passes
+ *   misses       cache misses per service and pass (perf_event_open;
+ *                "-" where the kernel does not allow it)
+ *
+ *   ./tablebench [passes]      (default 200)
+ */
+
+#define MAX_SVC 4096
+#define RATOS_INIT_NO_MAIN
+#include "../init.c"
+
+#include <malloc.h>
+#include <linux/perf_event.h>
+
+static const char *sample =
+    "Name=httpd-%d\n"
+    "ExecStart=/usr/sbin/httpd -f -p %d -h /srv/www\n"
+    "Restart=always\n"
+    "Environment=LANG=C.UTF-8 \"GREETING=hello world\"\n"
+    "LogRateLimitBurst=500\n"
+    "TTYPath=/dev/tty1\n";
+
+static long rss_kb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    while (f && fgets(line, sizeof(line), f))
+        if (strncmp(line, "VmRSS:", 6)==0) kb = strtol(line + 6, NULL, 10);
+    if (f) fclose(f);
+    return kb;
+}
+
+static int perf_open(void) {
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_MISSES;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* what the supervise loop reads for every service on every pass */
+static volatile long sink;
+static void scan(int want) {
+    long acc = 0;
+    for (int i=0;i<nservices;i++) {
+        service *s = &services[i];
+        if (s->running && s->pid == want) acc += i;
+        if (s->outr >= 0) acc += s->outr;
+        if (s->rl_suppressed) acc++;
+    }
+    sink = acc;
+}
+
+static void run(int n, int passes, int pfd) {
+    static char evict[32 << 20];
+    char text[512];
+    nservices = 0;
+    long rss0 = rss_kb();
+    size_t heap0 = mallinfo2().uordblks;
+    for (int i=0;i<n;i++) {
+        int len = snprintf(text, sizeof(text), sample, i, 8000 + i);
+        FILE *f = fmemopen(text, (size_t)len, "r");
+        if (!f) { perror("fmemopen"); _exit(1); }
+        parse_service(f);
+        fclose(f);
+    }
+    if (nservices != n) { fprintf(stderr, "loaded %d of %d services\n", nservices, n); _exit(1); }
+    long rss = rss_kb() - rss0;
+    size_t heap = mallinfo2().uordblks - heap0;
+    for (int i=0;i<n;i++) { services[i].pid = 1000 + i; services[i].running = 1; }
+
+    double ns = 0;
+    long long misses = 0;
+    for (int p=0;p<passes;p++) {
+        memset(evict, p, sizeof(evict));
+        long long c = 0;
+        if (pfd >= 0) { ioctl(pfd, PERF_EVENT_IOC_RESET, 0); ioctl(pfd, PERF_EVENT_IOC_ENABLE, 0); }
+        double t0 = now_ns();
+        scan(1000 + n - 1);
+        ns += now_ns() - t0;
+        if (pfd >= 0) {
+            ioctl(pfd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(pfd, &c, sizeof(c)) == sizeof(c)) misses += c;
+        }
+    }
+    char mstr[32] = "-";
+    if (pfd >= 0) snprintf(mstr, sizeof(mstr), "%.2f", (double)misses / passes / n);
+    printf("%8d %8zu %8ld %8zu %8.1f %8s\n", n, sizeof(service), rss, heap / 1024,
+           ns / passes / n, mstr);
+}
+
+int main(int argc, char **argv) {
+    int passes = argc > 1 ? atoi(argv[1]) : 200;
+    if (passes < 1) passes = 200;
+    /* parse warnings and the like */
+    con.level = CON_ERR;
+    int pfd = perf_open();
+    printf("%8s %8s %8s %8s %8s %8s\n", "services", "record", "rss KB", "heap KB", "scan ns", "misses");
+    static const int sizes[] = { 128, 1024, 4096 };
+    /* each size in a fresh process, so RSS starts from the same point */
+    for (size_t i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) { run(sizes[i], passes, pfd); fflush(stdout); _exit(0); }
+        if (pid > 0) waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
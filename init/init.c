@@ -1,162 +1,2790 @@
 /* ratos-init.c - Minimal init + service supervisor for RatOS
  *
  * Build:
- *   gcc -static -O2 -o init init.c
+ *   gcc -static -O2 -pthread -o init init.c
  *
  * Install to /init
  *
- * Service files are simple key=value text files placed in /etc/ratos/services/*.conf
+ * Service files are simple key=value text files, the .conf files in /etc/ratos/services
  * Example:
  *   Name=getty-tty1
  *   ExecStart=/bin/sh -c "/bin/login"    # or /bin/sh -l
  *   Restart=on-failure
  *
+ * Environment:
+ *   Environment=FOO=1 "BAR=a b"  # may be repeated
+ *   EnvironmentFile=/etc/default/foo   # KEY=VALUE lines; "-/path" if optional
+ * Services get init's environment plus these, plus RATOS_SERVICE and
+ * RATOS_RESTARTS. The envp (and, when ExecStart needs no shell features,
+ * the argv) is built once at load and rebuilt only when an
+ * EnvironmentFile changes, so a restart is a plain execve().
+ *
+ * Credentials (resolved from /etc/passwd and /etc/group at load time):
+ *   User=daemon                  # name or uid; also sets USER, LOGNAME, HOME
+ *   Group=daemon                 # default: the user's primary group
+ *   SupplementaryGroups=audio video   # added to the groups listing User
+ *
+ * Sandboxing, set up in the child between clone3() and execve():
+ *   PrivateTmp=yes               # fresh tmpfs on /tmp and /var/tmp
+ *   PrivateNetwork=yes           # own network namespace with only lo
+ *   ProtectSystem=yes|full|strict   # /usr,/boot ro; +/etc; whole fs ro
+ *   ReadOnlyPaths=/a -/b         # '-': ignore if missing; repeatable
+ *   RootDirectory=/srv/jail      # chroot; ReadOnlyPaths= and ExecStart=
+ *                                # are inside it, stdio paths are not
+ *   SystemCallFilter=@system-service   # allow only these (plus @default);
+ *   SystemCallFilter=~@mount @debug    # '~': allow all but these
+ *   SystemCallErrorNumber=EPERM  # fail filtered calls instead of killing
+ * Groups are listed in syscalls.h. The filter is compiled to BPF once at
+ * load and installed just before execve(), after credentials are dropped.
+ *
+ * Capabilities, applied in the child with prctl()/capset():
+ *   CapabilityBoundingSet=CAP_NET_BIND_SERVICE CAP_CHOWN   # '~': all but
+ *   AmbientCapabilities=CAP_NET_BIND_SERVICE   # kept across User= and exec
+ *   NoNewPrivileges=yes          # setuid/file caps no longer raise privilege
+ *
+ * Service stdout/stderr is captured by init through a pipe and appended to
+ * /var/log/<name>.log, subject to a per-service rate limit:
+ *   LogRateLimitIntervalSec=30   # 0 disables rate limiting; at most 86400
+ *   LogRateLimitBurst=10000      # lines allowed per interval; 0 disables; at most 1000000
+ *   LogSampleDebug=10            # keep 1 in N lines tagged <7> (debug)
+ * Where stdio goes can be changed per stream:
+ *   StandardInput=null|tty|socket|file:/path        # default null
+ *   StandardOutput=journal|null|tty|inherit|file:/path|append:/path
+ *   StandardError=...            # same choices; default inherit (= stdout)
+ * (StandardOutput=inherit shares a tty stdin, and is journal otherwise.)
+ *   TTYPath=/dev/tty2            # for tty; default /dev/console
+ * file:, append: and TTYPath= are opened before any RootDirectory= chroot,
+ * so they name paths on the host.
+ * "journal" is the captured logfile described here; a service that sends
+ * neither stream to it gets no capture pipe and costs init nothing.
+ * Suppressed lines are counted and reported in the log once output is
+ * allowed again. Each line is prefixed with the time init received it;
+ *   LogTimestamps=no             # keep lines byte-for-byte
+ * With LogTimestamps=no and no rate limit or sampling the pipe is spliced
+ * straight into the logfile without being copied through init.
+ * Every logfile gets a <name>.log.idx time index (see logindex.h) that
+ * ratos-log uses for --since/--until queries.
+ *   LogStructured=yes            # parse key=value / flat JSON fields
+ * In structured mode init also stores each 64 KB segment's fields in
+ * columns with a bloom filter, for ratos-log --field key=value.
+ *
+ * Core dumps of crashing processes are piped by the kernel to this binary
+ * (run as "init --coredump ..."), which spools them to disk at normal
+ * priority, so the crashed process can be reaped and restarted at once,
+ * then compresses them with zstd or gzip, if installed, at idle I/O
+ * priority into /var/lib/ratos/coredumps/<name>/.
+ * Files are named <time>-<pid>-r<restarts>-sig<N>.core[.zst|.gz]. Oldest
+ * dumps are removed to keep each service under its quota:
+ *   CoredumpMaxSize=256M         # K/M/G suffixes; 0 disables dumps
+ *
+ * syslog(3) messages sent to /dev/log are received by init itself and
+ * appended to the logfile of the service that sent them (matched by the
+ * sender's session, since every service runs in its own session).
+ * Messages from unsupervised processes go to /var/log/syslog.log.
+ *
+ * Kernel messages are read from /dev/kmsg from early boot and kept in
+ * memory until /var/log/kernel.log can be opened; a writer thread does the
+ * actual file I/O so slow storage never stalls supervision.
+ *
+ * Kernel modules listed in the .conf files in /etc/modules-load.d (also
+ * /run and /usr/lib; one name per line, '#' comments, a file in /etc hides one of
+ * the same name further down) are loaded with finit_module() at boot,
+ * several at a time, each once its dependencies from modules.dep are in.
+ * Services start after the last one. Names must be module names, not
+ * aliases, and modprobe.d options are not applied.
+ *
+ * init allocates memory while services load and not afterwards: service
+ * strings go to an arena, each envp block is sized at load with room to
+ * grow, and log, syslog, kmsg and console buffers are static. SIGUSR1
+ * (outside container mode) prints a stats line to the console that
+ * includes init's heap allocations since boot and since load; the latter
+ * stays at 0 unless an EnvironmentFile grows past its block.
+ * bench/allocbench.c checks this against libc's malloc.
+ *
+ * Per-user instance, not PID 1 and not root:
+ *   init --user [--services-dir D] [--log-dir D] [--runtime-dir D]
+ * defaults to ~/.config/ratos/services, ~/.local/state/ratos/log and
+ * $XDG_RUNTIME_DIR/ratos (XDG variables honoured), which holds init.pid and
+ * the syslog socket "log". It becomes a child subreaper so daemonizing
+ * services are still reaped, and does no mounts, getty or poweroff. The
+ * directory options also work for the system instance.
+ *
+ * Container mode, as PID 1 of a container:
+ *   init --container [-- command args...]
+ * It is also entered automatically when init is PID 1 and $container is
+ * set or /.dockerenv or /run/.containerenv exists. Nothing is mounted and
+ * there is no getty, /dev/log, kmsg reader, core_pattern, /var/log or
+ * poweroff. The command (with init's stdio) is the main service; without
+ * one, a service file with Main=yes is. SIGTERM, SIGINT, SIGHUP, SIGUSR1
+ * and SIGUSR2 are forwarded to it, and when it exits for good init stops
+ * the other services and exits with its status (128+N if killed by N).
+ *
+ * Kernel command line options (system instance only, read from
+ * /proc/cmdline once it is mounted):
+ *   ratos.target=rescue          # services start; root shell on the console
+ *   ratos.target=emergency       # no services, just the console shell
+ *   ratos.debug                  # explain loads and restart decisions
+ *   ratos.loglevel=warn          # console: err, warn, notice, info (default), debug
+ *   ratos.trace                  # timestamped boot/start/exit trace lines
+ *   ratos.max_parallel=4         # boot: start services in batches of this
+ *                                # many, the next once one exits or 100 ms
+ *                                # have passed (default: all at once)
+ *   ratos.services_dir=/dir      # unless --services-dir is given
+ *   ratos.nice=-10               # run the supervisor at this nice level
+ *   ratos.rtprio=10              # ...or SCHED_FIFO at this priority
+ *   ratos.protect=no             # skip mlockall and oom_score_adj (below)
+ *   ratos.modules=loop,fuse      # kernel modules to load, besides the lists
+ *   ratos.module_workers=4       # modules loaded at once (default: CPUs)
+ *
+ * The system and container instances lock their memory (as it is touched,
+ * where the kernel supports MCL_ONFAULT) and set oom_score_adj to -1000,
+ * so paging and the OOM killer cannot stall reaping when the box is under
+ * pressure. Services are put back to oom_score_adj 0, and to normal
+ * scheduling through SCHED_RESET_ON_FORK. bench/stressbench.c measures
+ * reap latency with the CPUs saturated.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <net/if.h>
+#include <linux/sched.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/capability.h>
+#include <grp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+
+#include "logindex.h"
+#include "syscalls.h"
+
+/* used from main(); the benchmarks build without it and use only parts */
+#ifdef RATOS_INIT_NO_MAIN
+#define MAIN_USED __attribute__((unused))
+#else
+#define MAIN_USED
+#endif
+
+#define SERVICES_DIR "/etc/ratos/services"   /* defaults; see --services-dir, --log-dir */
+#define LOGDIR "/var/log"
+#ifndef MAX_SVC               /* benchmarks may raise these two */
+#define MAX_SVC 128
+#endif
+#ifndef RESTART_BACKOFF_USEC
+#define RESTART_BACKOFF_USEC 1000000
+#endif
+#define BOOT_BATCH_USEC 100000    /* ratos.max_parallel=: pause between batches */
+#define MAX_LINE 1024
+#define SYSLOG_PATH "/dev/log"
+#define SYSLOG_BATCH 32       /* datagrams per recvmmsg() */
+#define SYSLOG_MSG_MAX 2048
+#define LOG_LINE_MAX 2048     /* partial lines longer than this are split */
+#define LOG_SCAN_MAX 16384    /* bytes scanned for newlines per pass */
+#define LOG_SEG_ROWS 2048     /* structured mode: rows and fields kept per segment */
+#define LOG_SEG_PAIRS 8192
+#define LOG_SEG_TEXT 65536
+#define LOG_COLS_MAX 32
+#define LOG_RL_INTERVAL 30
+#define LOG_RL_BURST 10000
+#define LOG_RL_INTERVAL_MAX 86400   /* clamped so refill arithmetic fits 64 bits */
+#define LOG_RL_BURST_MAX 1000000
+#define ENV_FILES_MAX 8
+#define ENV_FILE_BYTES 65536  /* EnvironmentFile= contents read per service */
+#define ENV_SLACK 1024        /* envp room for EnvironmentFiles to grow in place */
+#define RESTARTS_ENV_SIZE sizeof("RATOS_RESTARTS=4294967295")
+#define CRED_GROUPS_MAX 32
+#define RO_PATHS_MAX 16
+#define SECCOMP_NR_MAX 1024   /* syscall numbers a filter can name */
+#define DEFAULT_PATH "/sbin:/bin:/usr/sbin:/usr/bin"
+#define COREDUMP_DIR "/var/lib/ratos/coredumps"
+#define COREDUMP_MAX_DEFAULT (256ULL<<20)
+#define COREDUMP_PIPE_LIMIT 16    /* concurrent dumps; also keeps /proc/<pid> alive */
+#define COREDUMP_SPOOL_RATIO 8    /* raw core spooled for compression: up to quota x this */
+#define KMSG_PATH "/dev/kmsg"
+#define KMSG_BUF_SIZE (256*1024)  /* per buffer; two are swapped */
+
+typedef enum { R_NO=0, R_ON_FAILURE=1, R_ALWAYS=2 } restart_t;
+typedef enum { PS_NO=0, PS_YES=1, PS_FULL=2, PS_STRICT=3 } protect_t;
+typedef enum { STD_JOURNAL=0, STD_NULL, STD_TTY, STD_SOCKET, STD_FILE, STD_APPEND, STD_INHERIT } stdio_t;
+
+/* structured mode: fields of the open segment, written out when it closes */
+typedef struct log_seg {
+    uint64_t log_offset;
+    int open;
+    int overflow;        /* rows did not fit: bloom only, no columns */
+    uint32_t nrows, npairs, textlen;
+    struct { uint32_t off; uint16_t first, n; } rows[LOG_SEG_ROWS];
+    struct { uint16_t key, klen, val, vlen; } pairs[LOG_SEG_PAIRS];
+    char text[LOG_SEG_TEXT];
+    uint8_t bloom[LOG_BLOOM_BYTES];
+} log_seg;
+
+/*
+ * A service record. The fields the supervise loop looks at for every
+ * service on every pass come first and share one cache line; the rest is
+ * read at start and exit only. Strings, and the arrays behind options
+ * most services do not set, live in the string arena (below), not in the
+ * record.
+ */
+typedef struct arena_block arena_block;
+typedef struct { arena_block *block; size_t used; } arena_mark;
+
+/* an EnvironmentFile= and what it was when the envp was last built */
+typedef struct { char *path; dev_t dev; ino_t ino; off_t size; struct timespec mtime; } env_file;
+
+typedef struct service {
+    pid_t pid;
+    int running;
+    restart_t restart;
+    unsigned restarts;
+    int outr, outw;      /* stdout/stderr capture pipe, kept across restarts */
+    int logfd;           /* init's own append fd, opened on first use */
+    int structured;
+    unsigned long rl_suppressed;
+    const char *name;
+    char *partial;       /* LOG_LINE_MAX bytes: unterminated tail of the last read */
+    size_t partial_len;
+    /* cold */
+    char *execcmd;
+    char **argv;         /* execcmd split for execve(), NULL = run via /bin/sh -c */
+    char **envp;         /* single malloc'd block: pointers, then strings */
+    size_t env_size;     /* bytes allocated for envp */
+    char *environment;   /* Environment= assignments, '\n'-separated */
+    env_file *envfiles;  /* nenvfiles of them, in the arena */
+    int nenvfiles;
+    char *restarts_env;  /* "RATOS_RESTARTS=n", inside the envp block */
+    uint64_t restart_at; /* monotonic usec the backoff ends, 0 = no restart due */
+    int creds;           /* User=/Group=/SupplementaryGroups= given */
+    int cred_error;      /* ...but could not be resolved: refuse to start */
+    uid_t uid;
+    gid_t gid;
+    int ngroups;
+    gid_t *groups;       /* CRED_GROUPS_MAX, in the arena when creds is set */
+    char *user, *home;   /* for USER/LOGNAME/HOME */
+    /* sandbox */
+    int private_tmp, private_network;
+    protect_t protect_system;
+    char **ro_paths;     /* NULL-terminated, in the arena; NULL = none */
+    char *rootdir;
+    struct sock_filter *seccomp;   /* compiled SystemCallFilter=, malloc'd */
+    unsigned short seccomp_len;
+    int seccomp_error;   /* filter given but not compilable: refuse to start */
+    uint64_t cap_bounding;     /* capability bits; all set = leave alone */
+    uint64_t cap_ambient;
+    int no_new_privs;
+    stdio_t std[3];      /* StandardInput=, StandardOutput=, StandardError= */
+    char **std_path;     /* file:/append: targets, per fd; NULL = none */
+    char *tty_path;
+    uint64_t coredump_max;     /* bytes of dumps kept, 0 = no dumps */
+    const char *logfile;
+    int idxfd;           /* <logfile>.idx */
+    uint64_t log_size;   /* logfile size including staged, unflushed lines */
+    uint64_t idx_next;   /* add an index entry once log_size reaches this */
+    unsigned log_checked;      /* log_batch of the last truncation check */
+    int segfd, colfd;    /* <logfile>.seg, <logfile>.cols */
+    log_seg *seg;        /* malloc'd at load time, structured mode only */
+    /* rate limiting: token bucket refilled at rl_burst per rl_interval */
+    unsigned rl_interval;      /* seconds */
+    unsigned rl_burst;
+    unsigned rl_tokens;
+    uint64_t rl_refill;        /* monotonic usec of last refill */
+    unsigned sample_debug;     /* keep 1 in N debug lines, 0/1 = all */
+    unsigned long debug_seen;
+    int timestamps;            /* prefix lines with the receive time */
+    int no_splice;             /* splice() refused by the log filesystem */
+    arena_mark loaded;         /* string arena before this service was loaded */
+} __attribute__((aligned(64))) service;
+
+static service services[MAX_SVC];
+static int nservices = 0;
+static int ncapture = 0;     /* services with a capture pipe; never closed */
+static volatile sig_atomic_t need_reap = 0;
+static volatile sig_atomic_t terminate = 0;
+static const char *services_dir = SERVICES_DIR;
+static const char *log_dir = LOGDIR;
+static const char *runtime_dir = NULL;  /* user instance: pid file, syslog socket */
+static char syslog_path[108] = SYSLOG_PATH;
+MAIN_USED static int user_mode = 0;
+/* kernel command line */
+typedef enum { TARGET_DEFAULT=0, TARGET_RESCUE, TARGET_EMERGENCY } target_t;
+static const char *target_names[] = { "default", "rescue", "emergency" };
+static target_t boot_target = TARGET_DEFAULT;
+static int boot_trace = 0;
+static int max_parallel = 0;            /* 0 = start everything at once */
+static char *boot_services_dir = NULL;  /* in the string arena */
+static int boot_next = 0;               /* first service not started yet */
+static uint64_t boot_batch_at = 0;      /* ratos.max_parallel=: next batch not before */
+static int boot_exited = 0;             /* ...unless a service exited since the last */
+/* services waiting out the restart backoff; the backoff is fixed, so in
+ * restart_at order */
+static struct { int svc[MAX_SVC]; unsigned head, tail; } restartq;
+static int boot_nice = 0;               /* ratos.nice=, <0 to take effect */
+static int boot_rtprio = 0;             /* ratos.rtprio=, SCHED_FIFO if >0 */
+static int boot_protect = 1;
+static char *boot_modules = NULL;       /* ratos.modules=, in the string arena */
+static int module_workers = 0;          /* 0 = one per CPU */
+static int self_protected = 0;          /* oom_score_adj lowered: children reset it */
+/* container mode */
+static int container_mode = 0;
+static service *main_svc = NULL;
+static volatile sig_atomic_t main_pid = 0;
+static volatile sig_atomic_t main_stopping = 0;   /* SIGTERM/SIGINT forwarded */
+static int main_status = 0;
+static int wake_pipe[2] = { -1, -1 };   /* self-pipe: signals wake poll() */
+static int syslog_fd = -1;
+static int syslog_orphan_fd = -1;       /* messages from unsupervised pids */
+static int kmsg_fd = -1;
+static volatile sig_atomic_t need_stats = 0;
+
+/* every heap allocation init makes goes through here and is counted */
+static unsigned long heap_allocs = 0, heap_allocs_loaded = 0;
+
+static void *heap_alloc(size_t n) {
+    heap_allocs++;
+    return malloc(n);
+}
+
+/*
+ * String arena: everything a service keeps for its lifetime (names, paths,
+ * argv, its partial-line buffer) is bump-allocated here at load time
+ * rather than malloc'd piece by piece. Blocks are only added, never moved,
+ * so pointers stay valid; arena_release() drops back to a mark, which is
+ * how a rejected or unloaded service gives its strings back.
+ */
+#define ARENA_BLOCK (64*1024)
+struct arena_block {
+    arena_block *prev;
+    size_t used, size;
+    char data[];
+};
+static arena_block *str_arena = NULL;
+
+static void *arena_alloc(size_t n, size_t align) {
+    arena_block *b = str_arena;
+    size_t at = b ? (b->used + align - 1) & ~(align - 1) : 0;
+    if (!b || at + n > b->size) {
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        if (!(b = heap_alloc(sizeof(arena_block) + size))) return NULL;
+        b->prev = str_arena;
+        b->used = 0;
+        b->size = size;
+        str_arena = b;
+        at = 0;
+    }
+    b->used = at + n;
+    return b->data + at;
+}
+
+static char *arena_strdup(const char *str) {
+    size_t n = strlen(str) + 1;
+    char *p = arena_alloc(n, 1);
+    return p ? memcpy(p, str, n) : NULL;
+}
+
+static arena_mark arena_save(void) {
+    return (arena_mark){ str_arena, str_arena ? str_arena->used : 0 };
+}
+
+static void arena_release(arena_mark m) {
+    while (str_arena != m.block) {
+        arena_block *b = str_arena;
+        str_arena = b->prev;
+        free(b);
+    }
+    if (str_arena) str_arena->used = m.used;
+}
+
+/*
+ * Process, signal and time operations used by supervision go through sys,
+ * so a simulated backend (bench/initsim.c) can run the supervisor against
+ * fake processes and a virtual clock. spawn() returns the new pid like
+ * fork() does in the parent; the real one execs the service in the child.
+ * poll() is the supervise loop's wait; a simulated one passes the time.
+ */
+typedef struct sys_ops {
+    pid_t (*spawn)(service *s);
+    int (*kill)(pid_t pid, int sig);
+    pid_t (*waitpid)(pid_t pid, int *status, int flags);
+    void (*sleep)(uint64_t usec);
+    uint64_t (*clock)(clockid_t id);
+    int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout_ms);
+} sys_ops;
+
+static pid_t sys_spawn(service *s);
+static void sys_sleep(uint64_t usec);
+static uint64_t sys_clock(clockid_t id);
+static const sys_ops sys_real = { sys_spawn, kill, waitpid, sys_sleep, sys_clock, poll };
+static const sys_ops *sys = &sys_real;
+
+static void wake(void) {
+    int saved = errno;
+    if (wake_pipe[1] >= 0) (void)!write(wake_pipe[1], "", 1);
+    errno = saved;
+}
+MAIN_USED static void sigchld_handler(int sig) { (void)sig; need_reap = 1; wake(); }
+MAIN_USED static void sigterm_handler(int sig) { (void)sig; terminate = 1; wake(); }
+MAIN_USED static void sigusr1_handler(int sig) { (void)sig; need_stats = 1; wake(); }
+
+/*
+ * Console output. Status lines are queued in a ring and written to stdout
+ * without blocking, as far as the console takes them; the main loop sends
+ * the rest when stdout is writable again, so a slow serial console never
+ * stalls supervision. When the ring is full, lines are dropped and counted
+ * and the count is reported once there is room.
+ */
+#define CONSOLE_RING (64*1024)
+enum { CON_ERR = 3, CON_WARN = 4, CON_NOTICE = 5, CON_INFO = 6, CON_DEBUG = 7 };   /* as syslog levels */
+static const char *con_level_names[] = { "", "", "", "err", "warn", "notice", "info", "debug" };
+
+static struct {
+    int fd;              /* stdout, reopened non-blocking by console_open() */
+    int level;           /* lines above this level are not shown (ratos.loglevel=) */
+    size_t head, len;    /* queued: len bytes from ring[head], wrapping */
+    unsigned long dropped;
+    char ring[CONSOLE_RING];
+} con = { STDOUT_FILENO, CON_INFO, 0, 0, 0, "" };
+
+/* a file descriptor of its own, so O_NONBLOCK does not reach services that
+ * share init's stdout; regular files never block and keep fd 1 */
+MAIN_USED static void console_open(void) {
+    struct stat st;
+    if (fstat(STDOUT_FILENO, &st) < 0 || S_ISREG(st.st_mode)) return;
+    int fd = open("/proc/self/fd/1", O_WRONLY|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+    if (fd >= 0) con.fd = fd;
+}
+
+/* write what the console takes now */
+static void console_flush(void) {
+    while (con.len) {
+        size_t first = CONSOLE_RING - con.head < con.len ? CONSOLE_RING - con.head : con.len;
+        struct iovec iov[2] = {
+            { con.ring + con.head, first },
+            { con.ring, con.len - first },
+        };
+        ssize_t n = writev(con.fd, iov, con.len > first ? 2 : 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) { con.len = 0; return; }   /* console gone: nothing to wait for */
+        con.head = (con.head + (size_t)n) % CONSOLE_RING;
+        con.len -= (size_t)n;
+    }
+    con.head = 0;
+}
+
+static int console_put(const char *p, size_t n) {
+    if (n > CONSOLE_RING - con.len) return 0;
+    size_t tail = (con.head + con.len) % CONSOLE_RING;
+    size_t first = CONSOLE_RING - tail < n ? CONSOLE_RING - tail : n;
+    memcpy(con.ring + tail, p, first);
+    memcpy(con.ring, p + first, n - first);
+    con.len += n;
+    return 1;
+}
+
+static void vconsole(int level, const char *fmt, va_list ap) {
+    if (level > con.level) return;
+    char line[1024];
+    int n = snprintf(line, sizeof(line), "[init] ");
+    int m = vsnprintf(line + n, sizeof(line) - (size_t)n - 1, fmt, ap);
+    n = m < 0 ? n : n + m < (int)sizeof(line) - 1 ? n + m : (int)sizeof(line) - 2;
+    line[n++] = '\n';
+    if (con.dropped) {
+        char note[64];
+        int k = snprintf(note, sizeof(note), "[init] %lu console lines dropped\n", con.dropped);
+        if ((size_t)(k + n) > CONSOLE_RING - con.len) { con.dropped++; return; }
+        console_put(note, (size_t)k);
+        con.dropped = 0;
+    }
+    if (!console_put(line, (size_t)n)) con.dropped++;
+    console_flush();
+}
+
+static void console(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vconsole(level, fmt, ap);
+    va_end(ap);
+}
+
+/* perror(), through the console */
+static void console_perror(const char *what) {
+    console(CON_ERR, "%s: %s", what, strerror(errno));
+}
+
+/* shutdown: give the console a little time to take the rest */
+MAIN_USED static void console_drain(int ms) {
+    struct pollfd pfd = { .fd = con.fd, .events = POLLOUT };
+    while (con.len && ms > 0 && poll(&pfd, 1, 100) >= 0) {
+        console_flush();
+        ms -= 100;
+    }
+}
+
+/* ratos.debug and ratos.trace output */
+static void debug(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vconsole(CON_DEBUG, fmt, ap);
+    va_end(ap);
+}
+
+static void trace(const char *fmt, ...) {
+    if (!boot_trace) return;
+    uint64_t t = sys->clock(CLOCK_MONOTONIC);
+    char msg[512];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    console(CON_INFO, "trace %llu.%06llu %s", (unsigned long long)(t / 1000000), (unsigned long long)(t % 1000000), msg);
+}
+
+/* container mode: pass signals on to the main service */
+MAIN_USED static void forward_handler(int sig) {
+    pid_t pid = (pid_t)main_pid;
+    if (pid > 0) {
+        sys->kill(pid, sig);
+        if (sig == SIGTERM || sig == SIGINT) main_stopping = 1;
+    } else if (sig == SIGTERM || sig == SIGINT) {
+        terminate = 1;
+    }
+    wake();
+}
+
+/* utility: trim */
+static char *trim(char *s) {
+    while(*s==' '||*s=='\t') s++;
+    char *end = s + strlen(s);
+    while(end>s && (end[-1]=='\n' || end[-1]=='\r' || end[-1]==' ' || end[-1]=='\t')) end--;
+    *end = 0;
+    return s;
+}
+
+/* "64M"-style sizes */
+static uint64_t parse_size(const char *val) {
+    char *end;
+    uint64_t v = strtoull(val, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; break;
+    case 'm': case 'M': v <<= 20; break;
+    case 'g': case 'G': v <<= 30; break;
+    }
+    return v;
+}
+
+/*
+ * Credentials. A static binary has no usable NSS, so /etc/passwd and
+ * /etc/group are read directly; each is loaded once and reloaded only if it
+ * changed. Ids are resolved at load time so the child just calls set*id().
+ */
+static struct idfile {
+    const char *path;
+    char *buf;
+    struct stat st;
+} passwd_db = { "/etc/passwd", NULL, { 0 } }, group_db = { "/etc/group", NULL, { 0 } };
+
+static const char *idfile_get(struct idfile *f) {
+    struct stat st;
+    if (stat(f->path, &st) < 0) return NULL;
+    if (f->buf && st.st_ino == f->st.st_ino && st.st_size == f->st.st_size &&
+        st.st_mtim.tv_sec == f->st.st_mtim.tv_sec && st.st_mtim.tv_nsec == f->st.st_mtim.tv_nsec)
+        return f->buf;
+    free(f->buf);
+    f->buf = NULL;
+    int fd = open(f->path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return NULL;
+    if ((f->buf = heap_alloc((size_t)st.st_size + 1))) {
+        ssize_t n = read(fd, f->buf, (size_t)st.st_size);
+        f->buf[n > 0 ? n : 0] = 0;
+        f->st = st;
+    }
+    close(fd);
+    return f->buf;
+}
+
+/* copy the next line of *db into line and split it at ':'; -1 at the end */
+static int id_next(const char **db, char *line, size_t n, char **f, int max) {
+    const char *p = *db;
+    if (!p || !*p) return -1;
+    size_t len = strcspn(p, "\n");
+    *db = p + len + (p[len] == '\n');
+    if (len >= n) len = n - 1;
+    memcpy(line, p, len);
+    line[len] = 0;
+    int nf = 0;
+    for (char *q = line; nf < max; ) {
+        f[nf++] = q;
+        if (!(q = strchr(q, ':'))) break;
+        *q++ = 0;
+    }
+    return nf;
+}
+
+static int is_number(const char *s) {
+    if (!*s) return 0;
+    for (; *s; s++) if (*s < '0' || *s > '9') return 0;
+    return 1;
+}
+
+/* passwd entry by name or uid; numeric ids need not exist */
+static int lookup_user(service *s, const char *want) {
+    const char *db = idfile_get(&passwd_db);
+    char line[MAX_LINE], *f[7];
+    int nf, num = is_number(want);
+    while ((nf = id_next(&db, line, sizeof(line), f, 7)) >= 0) {
+        if (nf < 7) continue;
+        if (num ? strcmp(f[2], want) != 0 : strcmp(f[0], want) != 0) continue;
+        s->uid = (uid_t)strtoul(f[2], NULL, 10);
+        s->gid = (gid_t)strtoul(f[3], NULL, 10);
+        s->user = arena_strdup(f[0]);
+        s->home = arena_strdup(f[5]);
+        return 0;
+    }
+    if (!num) return -1;
+    s->uid = (uid_t)strtoul(want, NULL, 10);
+    s->gid = (gid_t)s->uid;
+    return 0;
+}
+
+static int lookup_group(const char *want, gid_t *gid) {
+    if (is_number(want)) { *gid = (gid_t)strtoul(want, NULL, 10); return 0; }
+    const char *db = idfile_get(&group_db);
+    char line[MAX_LINE], *f[4];
+    int nf;
+    while ((nf = id_next(&db, line, sizeof(line), f, 4)) >= 0) {
+        if (nf < 3 || strcmp(f[0], want) != 0) continue;
+        *gid = (gid_t)strtoul(f[2], NULL, 10);
+        return 0;
+    }
+    return -1;
+}
+
+static void add_group(service *s, gid_t g) {
+    for (int i=0;i<s->ngroups;i++) if (s->groups[i] == g) return;
+    if (s->ngroups < CRED_GROUPS_MAX) s->groups[s->ngroups++] = g;
+}
+
+static void resolve_creds(service *s, const char *user, const char *group, char *supp) {
+    s->creds = user[0] || group[0] || supp[0];
+    if (!s->creds) return;
+    if (!(s->groups = arena_alloc(CRED_GROUPS_MAX * sizeof(gid_t), sizeof(gid_t)))) {
+        s->cred_error = 1;
+        return;
+    }
+    if (user[0] && lookup_user(s, user) < 0) {
+        console(CON_WARN, "%s: unknown user %s", s->name, user);
+        s->cred_error = 1;
+        return;
+    }
+    if (group[0] && lookup_group(group, &s->gid) < 0) {
+        console(CON_WARN, "%s: unknown group %s", s->name, group);
+        s->cred_error = 1;
+        return;
+    }
+    add_group(s, s->gid);
+    /* groups that list the user as a member, like initgroups() */
+    if (s->user) {
+        const char *db = idfile_get(&group_db);
+        char line[MAX_LINE], *f[4];
+        int nf;
+        while ((nf = id_next(&db, line, sizeof(line), f, 4)) >= 0) {
+            if (nf < 4) continue;
+            for (char *m = strtok(f[3], ","); m; m = strtok(NULL, ","))
+                if (strcmp(m, s->user)==0) add_group(s, (gid_t)strtoul(f[2], NULL, 10));
+        }
+    }
+    for (char *g = strtok(supp, " \t,"); g; g = strtok(NULL, " \t,")) {
+        gid_t gid;
+        if (lookup_group(g, &gid) < 0) {
+            console(CON_WARN, "%s: unknown group %s", s->name, g);
+            s->cred_error = 1;
+            return;
+        }
+        add_group(s, gid);
+    }
+}
+
+/*
+ * Service environment and argv. Both are parsed from the service file once
+ * and kept ready for execve(), so starting a service does no string work.
+ */
+
+/* copy one word from *src to *dst, handling quotes and backslashes; a word
+ * ends at unquoted whitespace, or only at the end of the line if whole_line */
+static char *env_word(char **src, char **dst, int whole_line) {
+    char *p = *src, *out = *dst, *start = out;
+    char quote = 0;
+    while (*p == ' ' || *p == '\t') p++;
+    if (!*p || *p == '\n') { *src = p; return NULL; }
+    for (; *p && *p != '\n'; p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+            else if (*p == '\\' && quote == '"' && p[1]) *out++ = *++p;
+            else *out++ = *p;
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else if (*p == '\\' && p[1] && p[1] != '\n') {
+            *out++ = *++p;
+        } else if (!whole_line && (*p == ' ' || *p == '\t')) {
+            break;
+        } else {
+            *out++ = *p;
+        }
+    }
+    if (whole_line) while (out > start && (out[-1] == ' ' || out[-1] == '\t' || out[-1] == '\r')) out--;
+    *out++ = 0;
+    *src = p;
+    *dst = out;
+    return start;
+}
+
+/* add "KEY=VALUE" to envp, replacing an earlier KEY */
+static void env_put(char **envp, int *n, char *kv) {
+    size_t klen = strcspn(kv, "=");
+    if (klen == 0 || kv[klen] != '=') return;
+    for (int i=0;i<*n;i++)
+        if (strncmp(envp[i], kv, klen)==0 && envp[i][klen]=='=') { envp[i] = kv; return; }
+    envp[(*n)++] = kv;
+}
+
+/* read an EnvironmentFile into *buf (NUL-terminated), noting its identity;
+ * *buf and *room advance past it. Contents past the room are dropped at
+ * the last whole line. */
+static char *env_file_read(service *s, int i, char **buf, size_t *room) {
+    env_file *ef = &s->envfiles[i];
+    const char *path = ef->path[0] == '-' ? ef->path + 1 : ef->path;
+    ef->dev = 0; ef->ino = 0; ef->size = 0; ef->mtime = (struct timespec){ 0, 0 };
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        if (ef->path[0] != '-') console(CON_WARN, "%s: cannot read %s", s->name, path);
+        return NULL;
+    }
+    struct stat st;
+    char *start = *buf;
+    if (fstat(fd, &st) == 0 && *room > 0) {
+        size_t want = (size_t)st.st_size < *room - 1 ? (size_t)st.st_size : *room - 1;
+        ssize_t n = read(fd, start, want);
+        size_t len = n > 0 ? (size_t)n : 0;
+        if ((size_t)st.st_size > want) {
+            console(CON_WARN, "%s: %s: only the first %zu bytes used", s->name, path, want);
+            while (len && start[len-1] != '\n') len--;
+        }
+        start[len] = 0;
+        *buf += len + 1;
+        *room -= len + 1;
+        ef->dev = st.st_dev;
+        ef->ino = st.st_ino;
+        ef->size = st.st_size;
+        ef->mtime = st.st_mtim;
+    }
+    close(fd);
+    return start;
+}
+
+/* did any EnvironmentFile change since the envp was built? */
+static int env_files_changed(service *s) {
+    for (int i=0;i<s->nenvfiles;i++) {
+        const env_file *ef = &s->envfiles[i];
+        const char *path = ef->path[0] == '-' ? ef->path + 1 : ef->path;
+        struct stat st;
+        if (stat(path, &st) < 0) memset(&st, 0, sizeof(st));
+        if (st.st_dev != ef->dev || st.st_ino != ef->ino || st.st_size != ef->size ||
+            st.st_mtim.tv_sec != ef->mtime.tv_sec || st.st_mtim.tv_nsec != ef->mtime.tv_nsec) return 1;
+    }
+    return 0;
+}
+
+/* init's environment, then Environment=, then EnvironmentFile=, then ours.
+ * Rebuilt in place when it still fits, so a changed EnvironmentFile
+ * normally costs no allocation either. */
+static void build_env(service *s) {
+    extern char **environ;
+    static char file_buf[ENV_FILE_BYTES];
+    char *files[ENV_FILES_MAX], *fp = file_buf;
+    size_t room = sizeof(file_buf);
+    size_t bytes = (s->environment ? strlen(s->environment) + 1 : 0) + sizeof("RATOS_SERVICE=") + strlen(s->name) +
+                   RESTARTS_ENV_SIZE;
+    if (s->user) bytes += 2 * strlen(s->user) + strlen(s->home) + sizeof("USER=") + sizeof("LOGNAME=") + sizeof("HOME=");
+    int max = 6;
+    for (char **e = environ; *e; e++) max++;
+    for (int i=0;i<s->nenvfiles;i++) {
+        files[i] = env_file_read(s, i, &fp, &room);
+        if (files[i]) bytes += strlen(files[i]) + 1;
+    }
+    /* every assignment takes at least two bytes of input ("K=") */
+    max += (int)(bytes / 2) + 1;
+    size_t size = (size_t)max * sizeof(char*) + bytes;
+    char **envp = s->envp;
+    if (!envp || size > s->env_size) {
+        /* the first build leaves room for EnvironmentFiles to grow */
+        if (s->nenvfiles) size += ENV_SLACK;
+        if (!(envp = heap_alloc(size))) return;
+        free(s->envp);
+        s->envp = envp;
+        s->env_size = size;
+    }
+    char *arena = (char*)(envp + max);
+    int n = 0;
+    for (char **e = environ; *e; e++) env_put(envp, &n, *e);
+    char *p = s->environment, *kv;
+    if (s->user) {
+        kv = arena; arena += sprintf(arena, "USER=%s", s->user) + 1; env_put(envp, &n, kv);
+        kv = arena; arena += sprintf(arena, "LOGNAME=%s", s->user) + 1; env_put(envp, &n, kv);
+        kv = arena; arena += sprintf(arena, "HOME=%s", s->home) + 1; env_put(envp, &n, kv);
+    }
+    /* one line per Environment= */
+    for (; p && *p; p += *p == '\n')
+        while ((kv = env_word(&p, &arena, 0))) env_put(envp, &n, kv);
+    for (int i=0;i<s->nenvfiles;i++) {
+        for (p = files[i]; p && *p; ) {
+            while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+            if (*p == '#' || *p == ';') { p += strcspn(p, "\n"); continue; }
+            if (strncmp(p, "export ", 7)==0) p += 7;
+            if ((kv = env_word(&p, &arena, 1))) env_put(envp, &n, kv);
+        }
+    }
+    kv = arena;
+    arena += sprintf(arena, "RATOS_SERVICE=%s", s->name) + 1;
+    env_put(envp, &n, kv);
+    /* sized for any count, so restart_service() rewrites it in place */
+    s->restarts_env = arena;
+    snprintf(s->restarts_env, RESTARTS_ENV_SIZE, "RATOS_RESTARTS=%u", s->restarts);
+    env_put(envp, &n, s->restarts_env);
+    envp[n] = NULL;
+}
+
+/* resolve a command name through the service's PATH into full (PATH_MAX) */
+static int find_in_path(service *s, const char *cmd, char *full) {
+    const char *path = DEFAULT_PATH;
+    for (char **e = s->envp; e && *e; e++) if (strncmp(*e, "PATH=", 5)==0) path = *e + 5;
+    while (*path) {
+        size_t dl = strcspn(path, ":");
+        snprintf(full, PATH_MAX, "%.*s/%s", (int)dl, path, cmd);
+        if (s->rootdir) {
+            char inroot[PATH_MAX];
+            snprintf(inroot, sizeof(inroot), "%s%s", s->rootdir, full);
+            if (access(inroot, X_OK) == 0) return 1;
+        } else if (access(full, X_OK) == 0) {
+            return 1;
+        }
+        path += dl + (path[dl] == ':');
+    }
+    return 0;
+}
+
+/* split ExecStart for a direct execve() unless it needs a shell */
+static void build_argv(service *s) {
+    const char *cmd = s->execcmd;
+    if (strpbrk(cmd, "|&;<>()$`*?[]{}~#\n")) return;
+    size_t len = strlen(cmd) + 1;
+    if (len > MAX_LINE) return;
+    /* split into scratch space (env_word cannot split in place), then
+     * copy just what is used into the arena */
+    char *words[MAX_LINE/2 + 2];
+    char copy[MAX_LINE], text[MAX_LINE + PATH_MAX];
+    char *src = strcpy(copy, cmd), *out = text, *p;
+    int n = 0;
+    while ((p = env_word(&src, &out, 0))) words[n++] = p;
+    /* a leading FOO=bar is a shell assignment */
+    if (n == 0 || strchr(words[0], '=')) return;
+    /* resolve through the service's PATH now rather than at every exec */
+    if (!strchr(words[0], '/')) {
+        if (!find_in_path(s, words[0], out)) return;
+        words[0] = out;
+        out += strlen(out) + 1;
+    }
+    char **argv = arena_alloc((size_t)(n + 1) * sizeof(char*) + (size_t)(out - text), sizeof(char*));
+    if (!argv) return;
+    char *base = memcpy(argv + n + 1, text, (size_t)(out - text));
+    for (int i=0;i<n;i++) argv[i] = base + (words[i] - text);
+    argv[n] = NULL;
+    s->argv = argv;
+}
+
+/*
+ * SystemCallFilter=. The named calls become a bitmap, then a BPF program
+ * that binary-searches their sorted numbers, so a filtered call costs
+ * O(log n) comparisons however long the list is.
+ */
+#ifdef SYSCALL_AUDIT_ARCH
+static void seccomp_mark(service *s, uint8_t *set, const char *name, size_t len, int on) {
+    if (name[0] == '@') {
+        for (size_t i=0;i<sizeof(syscall_groups)/sizeof(syscall_groups[0]);i++) {
+            if (strlen(syscall_groups[i].name) != len || strncmp(syscall_groups[i].name, name, len)) continue;
+            for (const char *p = syscall_groups[i].calls; *p; ) {
+                size_t n = strcspn(p, " ");
+                seccomp_mark(s, set, p, n, on);
+                p += n; p += strspn(p, " ");
+            }
+            return;
+        }
+    } else {
+        for (size_t i=0;i<sizeof(syscall_names)/sizeof(syscall_names[0]);i++) {
+            if (strlen(syscall_names[i].name) != len || strncmp(syscall_names[i].name, name, len)) continue;
+            int nr = syscall_names[i].nr;
+            if (nr >= 0 && nr < SECCOMP_NR_MAX) {
+                if (on) set[nr/8] |= (uint8_t)(1 << nr%8); else set[nr/8] &= (uint8_t)~(1 << nr%8);
+            }
+            return;
+        }
+    }
+    console(CON_WARN, "%s: unknown system call %.*s", s->name, (int)len, name);
+}
+
+static struct sock_filter bpf[BPF_MAXINSNS];
+static size_t nbpf;
+
+static void bpf_emit(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+    if (nbpf < BPF_MAXINSNS) bpf[nbpf] = (struct sock_filter)BPF_JUMP(code, k, jt, jf);
+    nbpf++;
+}
+
+/* return hit if the syscall number in A is one of nr[0..n), else miss */
+static void bpf_search(const int *nr, int n, uint32_t hit, uint32_t miss) {
+    if (n <= 4) {
+        for (int i=0;i<n;i++) {
+            bpf_emit(BPF_JMP|BPF_JEQ|BPF_K, (uint32_t)nr[i], 0, 1);
+            bpf_emit(BPF_RET|BPF_K, hit, 0, 0);
+        }
+        bpf_emit(BPF_RET|BPF_K, miss, 0, 0);
+        return;
+    }
+    int mid = n / 2;
+    /* conditional jumps only reach 255 ahead: hop over the lower half with ja */
+    bpf_emit(BPF_JMP|BPF_JGE|BPF_K, (uint32_t)nr[mid], 0, 1);
+    size_t ja = nbpf;
+    bpf_emit(BPF_JMP|BPF_JA, 0, 0, 0);
+    bpf_search(nr, mid, hit, miss);
+    if (ja < BPF_MAXINSNS) bpf[ja].k = (uint32_t)(nbpf - ja - 1);
+    bpf_search(nr + mid, n - mid, hit, miss);
+}
+
+/* spec: one SystemCallFilter= value per line; errnum 0 = kill the process */
+static void build_seccomp(service *s, char *spec, int errnum) {
+    uint8_t set[SECCOMP_NR_MAX/8];
+    memset(set, 0, sizeof(set));
+    int allow = spec[0] != '~';
+    if (allow) seccomp_mark(s, set, "@default", 8, 1);
+    for (char *line = strtok(spec, "\n"); line; line = strtok(NULL, "\n")) {
+        int invert = line[0] == '~';
+        line += invert;
+        /* a line of the other polarity takes calls back out of the set */
+        int on = allow ? !invert : invert;
+        for (char *p = line; *p; ) {
+            size_t n = strcspn(p, " \t");
+            if (n) seccomp_mark(s, set, p, n, on);
+            p += n; p += strspn(p, " \t");
+        }
+    }
+    int nr[SECCOMP_NR_MAX], n = 0;
+    for (int i=0;i<SECCOMP_NR_MAX;i++) if (set[i/8] & (1 << i%8)) nr[n++] = i;
+    uint32_t deny = errnum ? SECCOMP_RET_ERRNO | ((uint32_t)errnum & SECCOMP_RET_DATA) : SECCOMP_RET_KILL_PROCESS;
+
+    nbpf = 0;
+    bpf_emit(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch), 0, 0);
+    bpf_emit(BPF_JMP|BPF_JEQ|BPF_K, SYSCALL_AUDIT_ARCH, 1, 0);
+    bpf_emit(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS, 0, 0);
+    bpf_emit(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr), 0, 0);
+#ifdef __x86_64__
+    /* x32 calls share the arch value but not the numbers */
+    bpf_emit(BPF_JMP|BPF_JGE|BPF_K, 0x40000000, 0, 1);
+    bpf_emit(BPF_RET|BPF_K, SECCOMP_RET_KILL_PROCESS, 0, 0);
+#endif
+    bpf_search(nr, n, allow ? SECCOMP_RET_ALLOW : deny, allow ? deny : SECCOMP_RET_ALLOW);
+    if (nbpf > BPF_MAXINSNS || !(s->seccomp = heap_alloc(nbpf * sizeof(struct sock_filter)))) {
+        s->seccomp_error = 1;
+        return;
+    }
+    memcpy(s->seccomp, bpf, nbpf * sizeof(struct sock_filter));
+    s->seccomp_len = (unsigned short)nbpf;
+}
+#else
+static void build_seccomp(service *s, char *spec, int errnum) {
+    (void)spec; (void)errnum;
+    console(CON_WARN, "%s: SystemCallFilter= is not supported on this architecture", s->name);
+    s->seccomp_error = 1;
+}
+#endif
+
+/* capability names by number, without the CAP_ prefix */
+static const char *cap_names[] = {
+    "chown", "dac_override", "dac_read_search", "fowner", "fsetid", "kill",
+    "setgid", "setuid", "setpcap", "linux_immutable", "net_bind_service",
+    "net_broadcast", "net_admin", "net_raw", "ipc_lock", "ipc_owner",
+    "sys_module", "sys_rawio", "sys_chroot", "sys_ptrace", "sys_pacct",
+    "sys_admin", "sys_boot", "sys_nice", "sys_resource", "sys_time",
+    "sys_tty_config", "mknod", "lease", "audit_write", "audit_control",
+    "setfcap", "mac_override", "mac_admin", "syslog", "wake_alarm",
+    "block_suspend", "audit_read", "perfmon", "bpf", "checkpoint_restore",
+};
+
+static uint64_t parse_caps(const char *svc, char *val) {
+    uint64_t mask = 0;
+    for (char *p = strtok(val, " \t"); p; p = strtok(NULL, " \t")) {
+        const char *name = strncasecmp(p, "CAP_", 4)==0 ? p + 4 : p;
+        size_t i = 0;
+        while (i < sizeof(cap_names)/sizeof(cap_names[0]) && strcasecmp(name, cap_names[i])) i++;
+        if (i < sizeof(cap_names)/sizeof(cap_names[0])) mask |= 1ULL << i;
+        else console(CON_WARN, "%s: unknown capability %s", svc, p);
+    }
+    return mask;
+}
+
+/* fd: 0 for StandardInput=, 1/2 for StandardOutput=/StandardError= */
+static stdio_t parse_stdio(service *s, int fd, const char *val) {
+    int append = fd && strncasecmp(val, "append:", 7)==0;
+    if (append || strncasecmp(val, "file:", 5)==0) {
+        if (!s->std_path && (s->std_path = arena_alloc(3 * sizeof(char*), sizeof(char*))))
+            s->std_path[0] = s->std_path[1] = s->std_path[2] = NULL;
+        if (!s->std_path || !(s->std_path[fd] = arena_strdup(val + (append ? 7 : 5)))) {
+            console(CON_WARN, "%s: out of memory for %s, using null", s->name, val);
+            return STD_NULL;
+        }
+        return append ? STD_APPEND : STD_FILE;
+    }
+    if (strcasecmp(val, "null")==0) return STD_NULL;
+    if (strcasecmp(val, "tty")==0) return STD_TTY;
+    if (fd == 0 && strcasecmp(val, "socket")==0) {
+        /* there is no socket activation to hand one over */
+        console(CON_WARN, "%s: StandardInput=socket is not supported, using null", s->name);
+        return STD_NULL;
+    }
+    if (fd && strcasecmp(val, "journal")==0) return STD_JOURNAL;
+    if (fd && strcasecmp(val, "inherit")==0) return STD_INHERIT;
+    console(CON_WARN, "%s: bad %s=%s", s->name, fd == 0 ? "StandardInput" : fd == 1 ? "StandardOutput" : "StandardError", val);
+    return fd == 0 ? STD_NULL : fd == 1 ? STD_JOURNAL : STD_INHERIT;
+}
+
+static int parse_errno(const char *val) {
+    static const struct { const char *name; int num; } names[] = {
+        { "EPERM", EPERM }, { "EACCES", EACCES }, { "ENOSYS", ENOSYS },
+        { "EINVAL", EINVAL }, { "EOPNOTSUPP", EOPNOTSUPP }, { "ENOENT", ENOENT },
+    };
+    for (size_t i=0;i<sizeof(names)/sizeof(names[0]);i++)
+        if (strcasecmp(val, names[i].name)==0) return names[i].num;
+    return (int)strtol(val, NULL, 10);
+}
+
+/* parse a simple key=value service file */
+static void parse_service(FILE *f) {
+    char line[MAX_LINE];
+    char name[128] = "";
+    char exec[MAX_LINE] = "";
+    char restart[MAX_LINE] = "no";
+    unsigned rl_interval = LOG_RL_INTERVAL, rl_burst = LOG_RL_BURST, sample_debug = 0;
+    int timestamps = 1, structured = 0;
+    uint64_t coredump_max = COREDUMP_MAX_DEFAULT;
+    char environment[4*MAX_LINE] = "";
+    char user[128] = "", group[128] = "", supp[MAX_LINE] = "";
+    char ro_paths[MAX_LINE] = "", rootdir[MAX_LINE] = "";
+    char syscall_filter[4*MAX_LINE] = "";
+    int syscall_errno = 0;
+    uint64_t cap_keep = 0, cap_drop = 0, cap_ambient = 0;
+    int cap_listed = 0, no_new_privs = 0, is_main = 0;
+    char std_spec[3][MAX_LINE] = { "null", "journal", "inherit" }, tty_path[MAX_LINE] = "";
+    int private_tmp = 0, private_network = 0;
+    protect_t protect_system = PS_NO;
+    char *envfiles[ENV_FILES_MAX];
+    int nenvfiles = 0;
+    int first = 1;
+    arena_mark mark = arena_save();
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strlen(line);
+        /* a UTF-8 byte order mark, as Windows editors write */
+        int bom = first && strncmp(line, "\xEF\xBB\xBF", 3)==0;
+        first = 0;
+        if (len == sizeof(line)-1 && line[len-1] != '\n') {
+            /* the rest would read as a line of its own: drop all of it */
+            int c = fgetc(f);
+            if (c != EOF && c != '\n') {
+                while ((c = fgetc(f)) != EOF && c != '\n') ;
+                console(CON_WARN, "service file line longer than %d bytes ignored", MAX_LINE-1);
+                continue;
+            }
+        }
+        if (bom) memmove(line, line+3, len-2);
+        char *p = strchr(line, '=');
+        if (!p) continue;
+        *p = 0;
+        char *key = trim(line);
+        char *val = trim(p+1);
+        if (strcasecmp(key,"name")==0 || strcasecmp(key,"Name")==0) {
+            strncpy(name, val, sizeof(name)-1);
+        }
+        else if (strcasecmp(key,"execstart")==0 || strcasecmp(key,"ExecStart")==0) {
+            strncpy(exec, val, sizeof(exec)-1);
+        }
+        else if (strcasecmp(key,"restart")==0 || strcasecmp(key,"Restart")==0) {
+            strncpy(restart, val, sizeof(restart)-1);
+        }
+        else if (strcasecmp(key,"LogRateLimitIntervalSec")==0) {
+            unsigned long v = strtoul(val, NULL, 10);
+            rl_interval = v > LOG_RL_INTERVAL_MAX ? LOG_RL_INTERVAL_MAX : (unsigned)v;
+        }
+        else if (strcasecmp(key,"LogRateLimitBurst")==0) {
+            unsigned long v = strtoul(val, NULL, 10);
+            rl_burst = v > LOG_RL_BURST_MAX ? LOG_RL_BURST_MAX : (unsigned)v;
+        }
+        else if (strcasecmp(key,"LogSampleDebug")==0) {
+            sample_debug = (unsigned)strtoul(val, NULL, 10);
+        }
+        else if (strcasecmp(key,"LogStructured")==0) {
+            structured = strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        }
+        else if (strcasecmp(key,"Environment")==0) {
+            size_t used = strlen(environment);
+            snprintf(environment + used, sizeof(environment) - used, "%s\n", val);
+        }
+        else if (strcasecmp(key,"EnvironmentFile")==0) {
+            if (nenvfiles < ENV_FILES_MAX) envfiles[nenvfiles++] = arena_strdup(val);
+        }
+        else if (strcasecmp(key,"User")==0) {
+            snprintf(user, sizeof(user), "%s", val);
+        }
+        else if (strcasecmp(key,"Group")==0) {
+            snprintf(group, sizeof(group), "%s", val);
+        }
+        else if (strcasecmp(key,"SupplementaryGroups")==0) {
+            size_t used = strlen(supp);
+            snprintf(supp + used, sizeof(supp) - used, " %s", val);
+        }
+        else if (strcasecmp(key,"PrivateTmp")==0) {
+            private_tmp = strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        }
+        else if (strcasecmp(key,"PrivateNetwork")==0) {
+            private_network = strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        }
+        else if (strcasecmp(key,"ProtectSystem")==0) {
+            if (strcasecmp(val,"strict")==0) protect_system = PS_STRICT;
+            else if (strcasecmp(val,"full")==0) protect_system = PS_FULL;
+            else if (strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0) protect_system = PS_YES;
+            else protect_system = PS_NO;
+        }
+        else if (strcasecmp(key,"ReadOnlyPaths")==0) {
+            size_t used = strlen(ro_paths);
+            snprintf(ro_paths + used, sizeof(ro_paths) - used, " %s", val);
+        }
+        else if (strcasecmp(key,"RootDirectory")==0) {
+            snprintf(rootdir, sizeof(rootdir), "%s", val);
+        }
+        else if (strcasecmp(key,"SystemCallFilter")==0) {
+            size_t used = strlen(syscall_filter);
+            snprintf(syscall_filter + used, sizeof(syscall_filter) - used, "%s\n", val);
+        }
+        else if (strcasecmp(key,"SystemCallErrorNumber")==0) {
+            syscall_errno = parse_errno(val);
+        }
+        else if (strcasecmp(key,"CapabilityBoundingSet")==0) {
+            if (val[0] == '~') {
+                cap_drop |= parse_caps(name, val + 1);
+            } else {
+                cap_keep |= parse_caps(name, val);
+                cap_listed = 1;
+            }
+        }
+        else if (strcasecmp(key,"AmbientCapabilities")==0) {
+            cap_ambient |= parse_caps(name, val);
+        }
+        else if (strcasecmp(key,"StandardInput")==0) {
+            snprintf(std_spec[0], sizeof(std_spec[0]), "%s", val);
+        }
+        else if (strcasecmp(key,"StandardOutput")==0) {
+            snprintf(std_spec[1], sizeof(std_spec[1]), "%s", val);
+        }
+        else if (strcasecmp(key,"StandardError")==0) {
+            snprintf(std_spec[2], sizeof(std_spec[2]), "%s", val);
+        }
+        else if (strcasecmp(key,"TTYPath")==0) {
+            snprintf(tty_path, sizeof(tty_path), "%s", val);
+        }
+        else if (strcasecmp(key,"Main")==0) {
+            is_main = strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        }
+        else if (strcasecmp(key,"NoNewPrivileges")==0) {
+            no_new_privs = strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        }
+        else if (strcasecmp(key,"CoredumpMaxSize")==0) {
+            coredump_max = parse_size(val);
+        }
+        else if (strcasecmp(key,"LogTimestamps")==0) {
+            timestamps = !(strcasecmp(val,"no")==0 || strcmp(val,"0")==0 || strcasecmp(val,"false")==0);
+        }
+    }
+    char logfile[PATH_MAX];
+    snprintf(logfile, sizeof(logfile), "%s/%s.log", log_dir, name);
+    if (name[0]==0 || exec[0]==0 || nservices >= MAX_SVC) {
+        arena_release(mark);
+        return;
+    }
+    service *s = &services[nservices++];
+    memset(s,0,sizeof(service));
+    s->loaded = mark;
+    s->name = arena_strdup(name);
+    s->execcmd = arena_strdup(exec);
+    s->logfile = arena_strdup(logfile);
+    s->partial = arena_alloc(LOG_LINE_MAX, 1);
+    if (!s->name || !s->execcmd || !s->logfile || !s->partial) {
+        arena_release(mark);
+        nservices--;
+        return;
+    }
+    s->restart = R_NO;
+    if (strcasecmp(restart,"always")==0) s->restart = R_ALWAYS;
+    else if (strcasecmp(restart,"on-failure")==0) s->restart = R_ON_FAILURE;
+    s->logfd = s->idxfd = s->segfd = s->colfd = -1;
+    s->structured = structured;
+    if (structured && (s->seg = heap_alloc(sizeof(log_seg)))) memset(s->seg, 0, sizeof(log_seg));
+    else s->structured = 0;
+    s->outr = s->outw = -1;
+    s->rl_interval = rl_interval;
+    s->rl_burst = rl_burst;
+    s->rl_tokens = rl_burst;
+    s->sample_debug = sample_debug;
+    s->timestamps = timestamps;
+    s->coredump_max = coredump_max;
+    if (environment[0]) s->environment = arena_strdup(environment);
+    if (nenvfiles && (s->envfiles = arena_alloc((size_t)nenvfiles * sizeof(env_file), sizeof(void*)))) {
+        memset(s->envfiles, 0, (size_t)nenvfiles * sizeof(env_file));
+        for (int i=0;i<nenvfiles;i++) s->envfiles[i].path = envfiles[i];
+        s->nenvfiles = nenvfiles;
+    }
+    resolve_creds(s, user, group, supp);
+    s->private_tmp = private_tmp;
+    s->private_network = private_network;
+    s->protect_system = protect_system;
+    if (rootdir[0]) s->rootdir = arena_strdup(rootdir);
+    if (ro_paths[0] && (s->ro_paths = arena_alloc((RO_PATHS_MAX + 1) * sizeof(char*), sizeof(char*)))) {
+        int nro = 0;
+        for (char *p = strtok(ro_paths, " \t"); p && nro < RO_PATHS_MAX; p = strtok(NULL, " \t"))
+            if ((s->ro_paths[nro] = arena_strdup(p))) nro++;
+        s->ro_paths[nro] = NULL;
+    }
+    if (syscall_filter[0]) build_seccomp(s, syscall_filter, syscall_errno);
+    s->cap_bounding = (cap_listed ? cap_keep : ~0ULL) & ~cap_drop;
+    s->cap_ambient = cap_ambient & s->cap_bounding;
+    s->no_new_privs = no_new_privs;
+    for (int i=0;i<3;i++) s->std[i] = parse_stdio(s, i, std_spec[i]);
+    /* only a tty on stdin can be written to: otherwise inherit means journal */
+    if (s->std[1] == STD_INHERIT && s->std[0] != STD_TTY) s->std[1] = STD_JOURNAL;
+    if (tty_path[0]) s->tty_path = arena_strdup(tty_path);
+    build_env(s);
+    build_argv(s);
+    if (is_main && !main_svc) main_svc = s;
+}
+
+static void parse_service_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    parse_service(f);
+    fclose(f);
+}
+
+/* container mode: the command line as a service named "main" on init's stdio */
+MAIN_USED static void add_main_command(char **cmd) {
+    if (nservices >= MAX_SVC) return;
+    service *s = &services[nservices++];
+    memset(s, 0, sizeof(service));
+    s->loaded = arena_save();
+    s->name = "main";
+    s->logfile = "";
+    size_t len = 1;
+    for (char **a = cmd; *a; a++) len += strlen(*a) + 1;
+    s->execcmd = arena_alloc(len, 1);
+    if (!s->execcmd) { nservices--; return; }
+    s->execcmd[0] = 0;
+    for (char **a = cmd; *a; a++) { if (a != cmd) strcat(s->execcmd, " "); strcat(s->execcmd, *a); }
+    s->logfd = s->idxfd = s->segfd = s->colfd = -1;
+    s->outr = s->outw = -1;
+    s->cap_bounding = ~0ULL;
+    s->coredump_max = COREDUMP_MAX_DEFAULT;
+    s->std[0] = s->std[1] = s->std[2] = STD_INHERIT;
+    build_env(s);
+    /* arguments are taken as given: never through a shell */
+    char full[PATH_MAX];
+    char *resolved;
+    if (!strchr(cmd[0], '/') && find_in_path(s, cmd[0], full) && (resolved = arena_strdup(full))) cmd[0] = resolved;
+    s->argv = cmd;
+    main_svc = s;
+}
+
+/* mkdir -p; the user instance's directories may not exist yet */
+MAIN_USED static void mkdir_p(const char *dir, mode_t mode) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        mkdir(path, mode);
+        *p = '/';
+    }
+    mkdir(path, mode);
+}
+
+/* the user instance's default directories, from the XDG variables */
+MAIN_USED static void user_dirs(void) {
+    static char dirs[3][PATH_MAX];
+    const char *home = getenv("HOME"), *x;
+    if (!home || !home[0]) home = "/";
+    if ((x = getenv("XDG_CONFIG_HOME")) && x[0]) snprintf(dirs[0], PATH_MAX, "%s/ratos/services", x);
+    else snprintf(dirs[0], PATH_MAX, "%s/.config/ratos/services", home);
+    if ((x = getenv("XDG_STATE_HOME")) && x[0]) snprintf(dirs[1], PATH_MAX, "%s/ratos/log", x);
+    else snprintf(dirs[1], PATH_MAX, "%s/.local/state/ratos/log", home);
+    if ((x = getenv("XDG_RUNTIME_DIR")) && x[0]) snprintf(dirs[2], PATH_MAX, "%s/ratos", x);
+    else snprintf(dirs[2], PATH_MAX, "/tmp/ratos-%u", (unsigned)getuid());
+    services_dir = dirs[0];
+    log_dir = dirs[1];
+    runtime_dir = dirs[2];
+}
+
+/* PID 1 of a container, going by what container managers leave behind */
+MAIN_USED static int detect_container(void) {
+    const char *c = getenv("container");
+    return (c && c[0]) || access("/.dockerenv", F_OK) == 0 || access("/run/.containerenv", F_OK) == 0;
+}
+
+/* ratos.* options from the kernel command line; quoting as the kernel does */
+MAIN_USED static void parse_cmdline(void) {
+    char buf[4096], words[4096];
+    int fd = open("/proc/cmdline", O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, buf, sizeof(buf)-1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = 0;
+    char *src = buf, *dst = words, *w;
+    while ((w = env_word(&src, &dst, 0))) {
+        if (strncmp(w, "ratos.", 6) != 0) continue;
+        char *key = w + 6, *val = strchr(key, '=');
+        if (val) *val++ = 0;
+        int on = !val || strcasecmp(val,"yes")==0 || strcmp(val,"1")==0 || strcasecmp(val,"true")==0;
+        if (strcmp(key, "debug")==0) con.level = on ? CON_DEBUG : CON_INFO;
+        else if (strcmp(key, "loglevel")==0 && val) {
+            int l = CON_DEBUG;
+            while (l >= CON_ERR && strcmp(val, con_level_names[l])) l--;
+            if (l >= CON_ERR) con.level = l;
+            else if (val[0] >= '0' && val[0] <= '7' && !val[1]) con.level = val[0] - '0';
+            else console(CON_WARN, "unknown ratos.loglevel=%s", val);
+        }
+        else if (strcmp(key, "trace")==0) boot_trace = on;
+        else if (strcmp(key, "max_parallel")==0 && val) max_parallel = atoi(val) > 0 ? atoi(val) : 0;
+        else if (strcmp(key, "nice")==0 && val) boot_nice = atoi(val) < -20 ? -20 : atoi(val) > 0 ? 0 : atoi(val);
+        else if (strcmp(key, "rtprio")==0 && val) boot_rtprio = atoi(val) < 0 ? 0 : atoi(val) > 99 ? 99 : atoi(val);
+        else if (strcmp(key, "protect")==0) boot_protect = on;
+        else if (strcmp(key, "modules")==0 && val && val[0]) boot_modules = arena_strdup(val);
+        else if (strcmp(key, "module_workers")==0 && val) module_workers = atoi(val) > 0 ? atoi(val) : 0;
+        else if (strcmp(key, "services_dir")==0 && val && val[0]) {
+            boot_services_dir = arena_strdup(val);
+        }
+        else if (strcmp(key, "target")==0 && val) {
+            int t = TARGET_EMERGENCY;
+            while (t >= 0 && strcmp(val, target_names[t])) t--;
+            if (t < 0) console(CON_WARN, "unknown ratos.target=%s, booting normally", val);
+            boot_target = t < 0 ? TARGET_DEFAULT : (target_t)t;
+        }
+        else console(CON_WARN, "unknown kernel option ratos.%s", key);
+    }
+    debug("kernel options: target=%s trace=%d max_parallel=%d services_dir=%s nice=%d rtprio=%d protect=%d",
+          target_names[boot_target], boot_trace, max_parallel, boot_services_dir ? boot_services_dir : "(default)",
+          boot_nice, boot_rtprio, boot_protect);
+}
+
+/* scan services directory */
+static void load_services(void) {
+    DIR *d = opendir(services_dir);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (e->d_type == DT_DIR) continue;
+        if (e->d_name[0]=='.') continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", services_dir, e->d_name);
+        parse_service_file(path);
+    }
+    closedir(d);
+}
+
+static void write_all(int fd, const char *p, size_t len) {
+    while (len) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0) { if (errno == EINTR) continue; return; }
+        p += r; len -= (size_t)r;
+    }
+}
+
+/* open a sidecar file of fixed-size records, dropping those that describe
+ * log bytes past the end of a truncated log; the uint64_t at 'field' is
+ * compared with the log size */
+static int log_sidecar_open(service *s, const char *ext, size_t recsize, size_t field) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", s->logfile, ext);
+    int fd = open(path, O_CREAT|O_RDWR|O_APPEND|O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    off_t end = lseek(fd, 0, SEEK_END);
+    end -= end % (off_t)recsize;
+    uint64_t v;
+    while (end > 0) {
+        if (pread(fd, &v, sizeof(v), end - (off_t)recsize + (off_t)field) != sizeof(v)) break;
+        if (v <= s->log_size) break;
+        end -= (off_t)recsize;
+    }
+    (void)!ftruncate(fd, end);
+    return fd;
+}
+
+/* open the index; every open starts a new block, so a block (and in
+ * structured mode its segment) never spans two runs of init */
+static void log_index_open(service *s) {
+    s->idx_next = s->log_size;
+    s->idxfd = log_sidecar_open(s, ".idx", sizeof(log_index_entry), offsetof(log_index_entry, offset));
+    if (!s->structured) return;
+    s->segfd = log_sidecar_open(s, ".seg", sizeof(log_seg_entry), offsetof(log_seg_entry, log_end));
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.cols", s->logfile);
+    s->colfd = open(path, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+}
+
+/* buffered writes of one column block */
+static struct { int fd; size_t len; char buf[16384]; } colout;
+
+static void col_put(const void *p, size_t len) {
+    if (colout.len + len > sizeof(colout.buf)) {
+        write_all(colout.fd, colout.buf, colout.len);
+        colout.len = 0;
+    }
+    if (len > sizeof(colout.buf)) { write_all(colout.fd, p, len); return; }
+    memcpy(colout.buf + colout.len, p, len);
+    colout.len += len;
+}
+
+/* write the open segment's columns and its .seg record */
+static void log_seg_close(service *s) {
+    log_seg *g = s->seg;
+    if (!g->open) return;
+    g->open = 0;
+    log_seg_entry e;
+    memset(&e, 0, sizeof(e));
+    e.log_offset = g->log_offset;
+    e.log_end = s->log_size;
+    memcpy(e.bloom, g->bloom, sizeof(e.bloom));
+
+    /* distinct keys, in order of first appearance */
+    uint32_t cols[LOG_COLS_MAX], ncols = 0;
+    for (uint32_t i=0;i<g->npairs && !g->overflow;i++) {
+        uint32_t c;
+        for (c=0;c<ncols;c++) {
+            uint32_t k = cols[c];
+            if (g->pairs[k].klen == g->pairs[i].klen &&
+                memcmp(g->text + g->pairs[k].key, g->text + g->pairs[i].key, g->pairs[i].klen) == 0) break;
+        }
+        if (c < ncols) continue;
+        if (ncols == LOG_COLS_MAX) g->overflow = 1;
+        else cols[ncols++] = i;
+    }
+
+    off_t at = s->colfd >= 0 ? lseek(s->colfd, 0, SEEK_END) : -1;
+    if (!g->overflow && g->nrows && at >= 0) {
+        uint32_t size = sizeof(log_cols_hdr) + g->nrows * 4;
+        for (uint32_t c=0;c<ncols;c++) size += 2u + g->pairs[cols[c]].klen + g->nrows * 2;
+        /* each value is stored once, under its first key match in the row */
+        for (uint32_t r=0;r<g->nrows;r++)
+            for (uint32_t c=0;c<ncols;c++)
+                for (uint32_t i=g->rows[r].first;i<(uint32_t)g->rows[r].first + g->rows[r].n;i++)
+                    if (g->pairs[i].klen == g->pairs[cols[c]].klen &&
+                        memcmp(g->text + g->pairs[i].key, g->text + g->pairs[cols[c]].key, g->pairs[i].klen) == 0) {
+                        size += g->pairs[i].vlen;
+                        break;
+                    }
+        log_cols_hdr h = { LOG_COLS_MAGIC, g->nrows, ncols, size, g->log_offset };
+        colout.fd = s->colfd;
+        colout.len = 0;
+        col_put(&h, sizeof(h));
+        for (uint32_t r=0;r<g->nrows;r++) col_put(&g->rows[r].off, 4);
+        for (uint32_t c=0;c<ncols;c++) {
+            uint16_t klen = g->pairs[cols[c]].klen;
+            col_put(&klen, 2);
+            col_put(g->text + g->pairs[cols[c]].key, klen);
+            uint16_t match[LOG_SEG_ROWS];
+            for (uint32_t r=0;r<g->nrows;r++) {
+                match[r] = LOG_COL_ABSENT;
+                uint16_t vlen = LOG_COL_ABSENT;
+                for (uint32_t i=g->rows[r].first;i<(uint32_t)g->rows[r].first + g->rows[r].n;i++)
+                    if (g->pairs[i].klen == klen &&
+                        memcmp(g->text + g->pairs[i].key, g->text + g->pairs[cols[c]].key, klen) == 0) {
+                        match[r] = (uint16_t)i;
+                        vlen = g->pairs[i].vlen;
+                        break;
+                    }
+                col_put(&vlen, 2);
+            }
+            for (uint32_t r=0;r<g->nrows;r++)
+                if (match[r] != LOG_COL_ABSENT)
+                    col_put(g->text + g->pairs[match[r]].val, g->pairs[match[r]].vlen);
+        }
+        write_all(colout.fd, colout.buf, colout.len);
+        e.cols_offset = (uint64_t)at;
+        e.cols_size = size;
+        e.nrows = g->nrows;
+    }
+    if (s->segfd >= 0) (void)!write(s->segfd, &e, sizeof(e));
+}
+
+/* record the fields of a line about to be written at s->log_size */
+static void log_seg_add(service *s, const char *p, size_t len) {
+    log_seg *g = s->seg;
+    log_field f[LOG_FIELDS_MAX];
+    int n = log_parse_fields(p, len, f, LOG_FIELDS_MAX);
+    if (n == 0) return;
+    for (int i=0;i<n;i++) log_bloom_add(g->bloom, log_field_hash(f[i].key, f[i].klen, f[i].val, f[i].vlen));
+    if (g->overflow) return;
+    size_t text = 0;
+    for (int i=0;i<n;i++) text += (size_t)f[i].klen + f[i].vlen;
+    if (g->nrows == LOG_SEG_ROWS || g->npairs + (uint32_t)n > LOG_SEG_PAIRS ||
+        g->textlen + text > LOG_SEG_TEXT) {
+        g->overflow = 1;
+        return;
+    }
+    g->rows[g->nrows].off = (uint32_t)(s->log_size - g->log_offset);
+    g->rows[g->nrows].first = (uint16_t)g->npairs;
+    g->rows[g->nrows].n = (uint16_t)n;
+    g->nrows++;
+    for (int i=0;i<n;i++) {
+        g->pairs[g->npairs].key = (uint16_t)g->textlen;
+        g->pairs[g->npairs].klen = f[i].klen;
+        memcpy(g->text + g->textlen, f[i].key, f[i].klen);
+        g->textlen += f[i].klen;
+        g->pairs[g->npairs].val = (uint16_t)g->textlen;
+        g->pairs[g->npairs].vlen = f[i].vlen;
+        memcpy(g->text + g->textlen, f[i].val, f[i].vlen);
+        g->textlen += f[i].vlen;
+        g->npairs++;
+    }
+}
+
+/* called before writing at s->log_size; starts a new block when due */
+static void log_index_add(service *s, uint64_t usec) {
+    if (s->log_size < s->idx_next) return;
+    s->idx_next = s->log_size + LOG_INDEX_STRIDE;
+    if (s->structured) {
+        log_seg_close(s);
+        log_seg *g = s->seg;
+        memset(g->bloom, 0, sizeof(g->bloom));
+        g->log_offset = s->log_size;
+        g->nrows = g->npairs = g->textlen = 0;
+        g->overflow = 0;
+        g->open = 1;
+    }
+    if (s->idxfd < 0) return;
+    log_index_entry e = { s->log_size, usec };
+    (void)!write(s->idxfd, &e, sizeof(e));
+}
+
+/* format CLOCK_REALTIME microseconds as 2026-10-17T15:50:56.123456Z */
+static size_t fmt_time(char *out, size_t n, uint64_t usec) {
+    /* the date part only changes once a second, so cache it per thread */
+    static __thread time_t last_sec = -1;
+    static __thread char date[24];
+    static __thread size_t date_len;
+    time_t sec = (time_t)(usec / 1000000);
+    if (sec != last_sec) {
+        struct tm tm;
+        gmtime_r(&sec, &tm);
+        date_len = strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+        last_sec = sec;
+    }
+    if (n < date_len + 9) return 0;
+    memcpy(out, date, date_len);
+    char *p = out + date_len;
+    unsigned us = (unsigned)(usec % 1000000);
+    *p++ = '.';
+    for (int i=5;i>=0;i--) { p[i] = (char)('0' + us % 10); us /= 10; }
+    p[6] = 'Z';
+    return date_len + 8;
+}
+
+static uint64_t sys_clock(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* returns early when a signal arrives (a SIGCHLD ends a stop timeout) */
+static void sys_sleep(uint64_t usec) {
+    struct timespec ts = { (time_t)(usec / 1000000), (long)(usec % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static uint64_t clock_usec(clockid_t id) { return sys->clock(id); }
+
+/*
+ * Log collector. Lines from a service's capture pipe and from /dev/log are
+ * rate limited per service, staged in one buffer and written with a single
+ * write() per batch instead of one per line.
+ */
+static struct {
+    int fd;
+    size_t len;
+    char buf[65536];
+} logout = { -1, 0, "" };
+
+static void log_flush(void) {
+    if (logout.len && logout.fd >= 0) write_all(logout.fd, logout.buf, logout.len);
+    logout.len = 0;
+}
+
+/* receive time of the batch being processed: "<time> ", realtime, monotonic */
+static char log_ts[40];
+static size_t log_ts_len;
+static uint64_t log_real, log_mono;
+static unsigned log_batch;   /* bumped per batch of reads */
+static int rl_pending;       /* some service has suppressed lines to report */
+
+static void log_stamp(void) {
+    log_batch++;
+    log_mono = clock_usec(CLOCK_MONOTONIC);
+    log_real = clock_usec(CLOCK_REALTIME);
+    log_ts_len = fmt_time(log_ts, sizeof(log_ts), log_real);
+    log_ts[log_ts_len++] = ' ';
+}
+
+/* a log truncated behind init's back (logrotate copytruncate, ": >") would
+ * be written on at the old offset, leaving a hole: reopen it instead, which
+ * also trims the sidecars. Only when nothing is staged for it, so log_size
+ * is the file offset. */
+static void log_check_truncated(service *s) {
+    struct stat st;
+    if (s->logfd < 0 || (logout.len && logout.fd == s->logfd)) return;
+    if (fstat(s->logfd, &st) < 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size >= s->log_size) return;
+    close(s->logfd);
+    if (s->idxfd >= 0) close(s->idxfd);
+    if (s->segfd >= 0) close(s->segfd);
+    if (s->colfd >= 0) close(s->colfd);
+    s->logfd = s->idxfd = s->segfd = s->colfd = -1;
+    if (s->seg) s->seg->open = 0;
+}
+
+/* init-side fd for a service's logfile. Not O_APPEND, since splice()
+ * refuses append-mode files; init is the only writer, so it seeks to the
+ * end once and checks for truncation once per batch (log_batch). */
+static int service_log_fd(service *s) {
+    if (s->log_checked != log_batch) {
+        s->log_checked = log_batch;
+        log_check_truncated(s);
+    }
+    if (s->logfd < 0) {
+        s->logfd = open(s->logfile, O_CREAT|O_WRONLY|O_CLOEXEC, 0644);
+        if (s->logfd < 0) return -1;
+        off_t end = lseek(s->logfd, 0, SEEK_END);
+        s->log_size = end > 0 ? (uint64_t)end : 0;
+        log_index_open(s);
+    }
+    return s->logfd;
+}
+
+/* stage one line (optionally timestamped, a newline is added) for fd */
+static void log_append(int fd, int stamp, const char *p, size_t len) {
+    size_t pre = stamp ? log_ts_len : 0;
+    if (fd != logout.fd || logout.len + pre + len + 1 > sizeof(logout.buf)) {
+        log_flush();
+        logout.fd = fd;
+    }
+    if (pre + len + 1 > sizeof(logout.buf)) {
+        struct iovec iov[3] = { { log_ts, pre }, { (void*)p, len }, { "\n", 1 } };
+        (void)!writev(fd, iov, 3);
+        return;
+    }
+    memcpy(logout.buf + logout.len, log_ts, pre);
+    memcpy(logout.buf + logout.len + pre, p, len);
+    logout.len += pre + len;
+    logout.buf[logout.len++] = '\n';
+}
+
+/* stage one line for a service's logfile, keeping its index up to date */
+static void log_service_append(service *s, int fd, const char *p, size_t len) {
+    log_index_add(s, log_real);
+    if (s->structured) log_seg_add(s, p, len);
+    log_append(fd, s->timestamps, p, len);
+    s->log_size += (s->timestamps ? log_ts_len : 0) + len + 1;
+}
+
+/* refill the bucket; whole tokens only, the remainder carries over */
+static void log_refill(service *s, uint64_t now) {
+    uint64_t period = (uint64_t)s->rl_interval * 1000000;
+    uint64_t elapsed = now - s->rl_refill;
+    uint64_t add = elapsed >= period ? s->rl_burst : elapsed * s->rl_burst / period;
+    if (add == 0) return;
+    if (s->rl_tokens + add >= s->rl_burst) {
+        s->rl_tokens = s->rl_burst;
+        s->rl_refill = now;
+    } else {
+        s->rl_tokens += (unsigned)add;
+        s->rl_refill += add * period / s->rl_burst;
+    }
+}
+
+/* report suppressed lines once the bucket has tokens again */
+static void log_report_suppressed(service *s, int fd) {
+    char msg[96];
+    int n = snprintf(msg, sizeof(msg), "[init] %lu lines suppressed by rate limit", s->rl_suppressed);
+    log_service_append(s, fd, msg, (size_t)n);
+    s->rl_suppressed = 0;
+}
+
+/* one complete line at syslog level (0-7, or -1 if unknown) */
+static void log_line(service *s, int level, const char *p, size_t len) {
+    int fd = service_log_fd(s);
+    if (fd < 0) return;
+    if (level == 7 && s->sample_debug > 1 && (s->debug_seen++ % s->sample_debug) != 0)
+        return;
+    if (s->rl_burst && s->rl_interval) {
+        log_refill(s, log_mono);
+        if (s->rl_tokens == 0) { s->rl_suppressed++; rl_pending = 1; return; }
+        s->rl_tokens--;
+        if (s->rl_suppressed) log_report_suppressed(s, fd);
+    }
+    log_service_append(s, fd, p, len);
+}
+
+/* "<N>" prefix as used by sd-daemon style loggers */
+static int line_level(const char *p, size_t len) {
+    if (len >= 3 && p[0] == '<' && p[1] >= '0' && p[1] <= '7' && p[2] == '>') return p[1] - '0';
+    return -1;
+}
+
+/*
+ * Newline scanning. Captured output is mostly short lines, so rather than
+ * calling memchr() once per line a whole chunk is compared 16 or 32 bytes
+ * at a time and the offsets of every '\n' are collected in one pass.
+ */
+static size_t scan_newlines_scalar(const char *p, size_t len, uint32_t *offs) {
+    size_t n = 0;
+    for (size_t i=0;i<len;i++) if (p[i] == '\n') offs[n++] = (uint32_t)i;
+    return n;
+}
+
+#if defined(__x86_64__)
+static size_t scan_newlines_sse2(const char *p, size_t len, uint32_t *offs) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0, n = 0;
+    for (; i+16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        while (m) { offs[n++] = (uint32_t)(i + (unsigned)__builtin_ctz(m)); m &= m-1; }
+    }
+    for (; i<len; i++) if (p[i] == '\n') offs[n++] = (uint32_t)i;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static size_t scan_newlines_avx2(const char *p, size_t len, uint32_t *offs) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0, n = 0;
+    for (; i+32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p+i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        while (m) { offs[n++] = (uint32_t)(i + (unsigned)__builtin_ctz(m)); m &= m-1; }
+    }
+    for (; i<len; i++) if (p[i] == '\n') offs[n++] = (uint32_t)i;
+    return n;
+}
+#endif
+
+static size_t (*scan_newlines)(const char *, size_t, uint32_t *) = scan_newlines_scalar;
+
+MAIN_USED static void select_scanner(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    scan_newlines = __builtin_cpu_supports("avx2") ? scan_newlines_avx2 : scan_newlines_sse2;
+#endif
+}
+
+/* add to the pending partial line, emitting it when full or at end of line */
+static void log_partial(service *s, const char *p, size_t n, int eol) {
+    while (n) {
+        size_t room = LOG_LINE_MAX - s->partial_len;
+        size_t take = n < room ? n : room;
+        memcpy(s->partial + s->partial_len, p, take);
+        s->partial_len += take;
+        p += take;
+        n -= take;
+        if (s->partial_len == LOG_LINE_MAX) {
+            log_line(s, line_level(s->partial, s->partial_len), s->partial, s->partial_len);
+            s->partial_len = 0;
+        }
+    }
+    if (eol && s->partial_len) {
+        log_line(s, line_level(s->partial, s->partial_len), s->partial, s->partial_len);
+        s->partial_len = 0;
+    }
+}
+
+/* split a chunk of captured output into lines, carrying partial lines over */
+static void log_output(service *s, const char *p, size_t len) {
+    static uint32_t offs[LOG_SCAN_MAX];
+    while (len) {
+        size_t chunk = len < LOG_SCAN_MAX ? len : LOG_SCAN_MAX;
+        size_t count = scan_newlines(p, chunk, offs);
+        size_t start = 0;
+        for (size_t k=0;k<count;k++) {
+            size_t end = offs[k];
+            if (s->partial_len) log_partial(s, p+start, end-start, 1);
+            else log_line(s, line_level(p+start, end-start), p+start, end-start);
+            start = end + 1;
+        }
+        if (start < chunk) log_partial(s, p+start, chunk-start, 0);
+        p += chunk;
+        len -= chunk;
+    }
+}
+
+/* raw output with nothing to filter can bypass init's buffers entirely */
+static int log_passthrough(service *s) {
+    return !s->timestamps && !s->no_splice && !s->structured && !(s->rl_burst && s->rl_interval)
+        && s->sample_debug <= 1 && s->partial_len == 0;
+}
+
+/* drain a service's capture pipe */
+MAIN_USED static void handle_output(service *s) {
+    if (log_passthrough(s)) {
+        log_batch++;
+        int fd = service_log_fd(s);
+        ssize_t r;
+        log_flush();
+        log_index_add(s, clock_usec(CLOCK_REALTIME));
+        while ((r = splice(s->outr, NULL, fd, NULL, 1<<20, SPLICE_F_NONBLOCK|SPLICE_F_MOVE)) > 0)
+            s->log_size += (uint64_t)r;
+        if (r == 0 || errno == EAGAIN) return;
+        s->no_splice = 1;   /* e.g. EINVAL: fall back to copying */
+    }
+    char buf[16384];
+    for (;;) {
+        ssize_t r = read(s->outr, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        log_stamp();
+        log_output(s, buf, (size_t)r);
+    }
+    log_flush();
+}
+
+/* periodic: emit pending suppression reports for quiet services */
+MAIN_USED static void log_tick(void) {
+    log_stamp();
+    if (rl_pending) {
+        rl_pending = 0;
+        for (int i=0;i<nservices;i++) {
+            service *s = &services[i];
+            if (!s->rl_suppressed) continue;
+            log_refill(s, log_mono);
+            if (s->rl_tokens && service_log_fd(s) >= 0) log_report_suppressed(s, s->logfd);
+            if (s->rl_suppressed) rl_pending = 1;
+        }
+    }
+    log_flush();
+}
+
+/* map a sender pid to its service: the main pid or anything in its session.
+ * A sender that already exited can no longer be looked up and returns NULL. */
+static service *service_by_pid(pid_t pid) {
+    if (pid <= 0) return NULL;
+    pid_t sid = getsid(pid);
+    for (int i=0;i<nservices;i++) {
+        service *s = &services[i];
+        if (s->running && (s->pid == pid || s->pid == sid)) return s;
+    }
+    return NULL;
+}
+
+/* bind /dev/log; failure just means no syslog capture */
+MAIN_USED static void open_syslog(void) {
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    memcpy(sun.sun_path, syslog_path, sizeof(sun.sun_path)-1);
+    int fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd < 0) { console_perror("syslog socket"); return; }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one));
+    unlink(syslog_path);
+    if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+        console_perror("bind syslog socket");
+        close(fd);
+        return;
+    }
+    chmod(syslog_path, 0666);
+    syslog_fd = fd;
+}
+
+/* drain /dev/log in batches and append each message to its service log */
+MAIN_USED static void handle_syslog(void) {
+    static char bufs[SYSLOG_BATCH][SYSLOG_MSG_MAX];
+    static char ctl[SYSLOG_BATCH][CMSG_SPACE(sizeof(struct ucred))];
+    struct mmsghdr msgs[SYSLOG_BATCH];
+    struct iovec iov[SYSLOG_BATCH];
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i=0;i<SYSLOG_BATCH;i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = SYSLOG_MSG_MAX;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctl[i]);
+        }
+        int n = recvmmsg(syslog_fd, msgs, SYSLOG_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) return;
+        log_stamp();
+        for (int i=0;i<n;i++) {
+            char *msg = bufs[i];
+            size_t len = msgs[i].msg_len;
+            pid_t pid = 0;
+            struct cmsghdr *c;
+            for (c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c)) {
+                if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_CREDENTIALS) {
+                    struct ucred uc;
+                    memcpy(&uc, CMSG_DATA(c), sizeof(uc));
+                    pid = uc.pid;
+                }
+            }
+            /* drop the <PRI> prefix and any trailing newline/NULs */
+            int level = -1;
+            if (len && msg[0] == '<') {
+                char *gt = memchr(msg, '>', len < 6 ? len : 6);
+                if (gt) {
+                    level = atoi(msg + 1) & 7;
+                    len -= (size_t)(gt + 1 - msg);
+                    msg = gt + 1;
+                }
+            }
+            while (len && (msg[len-1] == '\n' || msg[len-1] == 0)) len--;
+            service *s = service_by_pid(pid);
+            if (s) log_line(s, level, msg, len);
+            else if (syslog_orphan_fd >= 0) log_append(syslog_orphan_fd, 1, msg, len);
+        }
+        log_flush();
+        if (n < SYSLOG_BATCH) return;
+    }
+}
+
+/*
+ * Kernel log. Records are stored raw (monotonic timestamp, level, text) and
+ * only converted to wall-clock time when written, so anything buffered
+ * before the RTC/NTP has settled still gets a sensible timestamp.
+ */
+typedef struct kmsg_rec {
+    uint64_t usec;       /* kernel timestamp, CLOCK_MONOTONIC based */
+    uint16_t len;
+    uint8_t level;
+    char text[];
+} kmsg_rec;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *buf;           /* filled by the main loop */
+    char *spare;         /* owned by the writer while it flushes */
+    size_t len;
+    unsigned long dropped;
+    int stop;            /* shutdown: write what is queued, then exit */
+    int started;
+    pthread_t thread;
+} klog = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static char klog_a[KMSG_BUF_SIZE], klog_b[KMSG_BUF_SIZE];
+#define KMSG_PREFIX_MAX 64   /* timestamp and " <N> " */
+
+static void *klog_writer(void *arg) {
+    (void)arg;
+    static char out[KMSG_BUF_SIZE + KMSG_BUF_SIZE/2];
+    int fd = -1;
+    for (;;) {
+        pthread_mutex_lock(&klog.lock);
+        while (klog.len == 0 && klog.dropped == 0 && !klog.stop) pthread_cond_wait(&klog.cond, &klog.lock);
+        int idle = klog.len == 0 && klog.dropped == 0, stop = klog.stop;
+        pthread_mutex_unlock(&klog.lock);
+        if (idle) break;   /* stopping, nothing left */
+        /* opened without the lock: slow storage must not block kmsg_queue() */
+        if (fd < 0) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/kernel.log", log_dir);
+            fd = open(path, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+        }
+        if (fd < 0) {
+            /* /var/log not writable yet: keep buffering, retry later */
+            if (stop) break;
+            sleep(1);
+            continue;
+        }
+        pthread_mutex_lock(&klog.lock);
+        char *in = klog.buf;
+        size_t inlen = klog.len;
+        unsigned long dropped = klog.dropped;
+        klog.buf = klog.spare;
+        klog.spare = in;
+        klog.len = 0;
+        klog.dropped = 0;
+        pthread_mutex_unlock(&klog.lock);
+
+        uint64_t offset = clock_usec(CLOCK_REALTIME) - clock_usec(CLOCK_MONOTONIC);
+        size_t n = 0, pos = 0;
+        if (dropped)
+            n += (size_t)snprintf(out, sizeof(out), "kmsg: %lu records dropped\n", dropped);
+        while (pos < inlen) {
+            kmsg_rec *r = (kmsg_rec*)(in + pos);
+            /* short records grow more than 1.5x when formatted */
+            if (n + KMSG_PREFIX_MAX + r->len + 1 > sizeof(out)) {
+                write_all(fd, out, n);
+                n = 0;
+            }
+            n += fmt_time(out+n, sizeof(out)-n, r->usec + offset);
+            n += (size_t)snprintf(out+n, sizeof(out)-n, " <%u> ", r->level);
+            memcpy(out+n, r->text, r->len);
+            n += r->len;
+            out[n++] = '\n';
+            pos += (sizeof(kmsg_rec) + r->len + 7) & ~(size_t)7;
+        }
+        write_all(fd, out, n);
+    }
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+/* queue one "pri,seq,usec,flags;text" record for the writer */
+static void kmsg_queue(const char *rec, size_t len) {
+    const char *semi = memchr(rec, ';', len);
+    if (!semi) return;
+    unsigned pri = 0;
+    unsigned long long usec = 0;
+    if (sscanf(rec, "%u,%*u,%llu", &pri, &usec) != 2) return;
+    const char *text = semi + 1;
+    size_t tlen = len - (size_t)(text - rec);
+    const char *nl = memchr(text, '\n', tlen);   /* drop dictionary lines */
+    if (nl) tlen = (size_t)(nl - text);
+    if (tlen > UINT16_MAX) tlen = UINT16_MAX;
+    size_t need = (sizeof(kmsg_rec) + tlen + 7) & ~(size_t)7;
+    pthread_mutex_lock(&klog.lock);
+    if (klog.len + need > KMSG_BUF_SIZE) {
+        klog.dropped++;
+    } else {
+        kmsg_rec *r = (kmsg_rec*)(klog.buf + klog.len);
+        r->usec = usec;
+        r->len = (uint16_t)tlen;
+        r->level = pri & 7;
+        memcpy(r->text, text, tlen);
+        klog.len += need;
+    }
+    pthread_cond_signal(&klog.cond);
+    pthread_mutex_unlock(&klog.lock);
+}
+
+/* read every record currently available; /dev/kmsg returns one per read() */
+static void handle_kmsg(void) {
+    char rec[8192];
+    for (;;) {
+        ssize_t r = read(kmsg_fd, rec, sizeof(rec));
+        if (r < 0) {
+            if (errno == EINTR || errno == EPIPE) continue;  /* EPIPE: ring overran us */
+            return;
+        }
+        if (r == 0) return;
+        kmsg_queue(rec, (size_t)r);
+    }
+}
+
+/* shutdown: queue what the kernel has, let the writer finish it */
+MAIN_USED static void klog_stop(void) {
+    if (!klog.started) return;
+    handle_kmsg();
+    pthread_mutex_lock(&klog.lock);
+    klog.stop = 1;
+    pthread_cond_signal(&klog.cond);
+    pthread_mutex_unlock(&klog.lock);
+    pthread_join(klog.thread, NULL);
+    klog.started = 0;
+}
+
+MAIN_USED static void open_kmsg(void) {
+    klog.buf = klog_a;
+    klog.spare = klog_b;
+    kmsg_fd = open(KMSG_PATH, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if (kmsg_fd < 0) { console_perror("open " KMSG_PATH); return; }
+    handle_kmsg();
+    if (pthread_create(&klog.thread, NULL, klog_writer, NULL) != 0) {
+        console_perror("kmsg writer");
+        close(kmsg_fd);
+        kmsg_fd = -1;
+        return;
+    }
+    klog.started = 1;
+}
+
+/*
+ * Kernel modules. The names listed in modules-load.d files (and in
+ * ratos.modules=) are loaded at boot by a few worker threads with
+ * finit_module(), each module as soon as everything modules.dep says it
+ * needs is in, so independent modules load in parallel. The workers run
+ * while services are parsed; services start once they are done.
  */
+#define MODULES_MAX 512
+#define MODULE_DEPS_MAX 64
+#define MODULE_WORKERS_MAX 8
+#define MODULE_LISTS_MAX 64   /* list names remembered for hiding */
+#define MODULES_DIR "/lib/modules"
+#ifndef MODULE_INIT_COMPRESSED_FILE
+#define MODULE_INIT_COMPRESSED_FILE 4
+#endif
+static const char *modules_load_dirs[] = { "/etc/modules-load.d", "/run/modules-load.d", "/usr/lib/modules-load.d" };
 
-#define _GNU_SOURCE
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-#include <sys/mount.h>
-#include <fcntl.h>
-#include <signal.h>
-#include <dirent.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
+typedef enum { MOD_WAITING=0, MOD_LOADING, MOD_DONE, MOD_FAILED } mod_state_t;
+#define MOD_ERR_DEP 1        /* mod[].err besides -errno: a dependency failed */
+#define MOD_ERR_CYCLE 2      /* ...or depends on itself */
 
-#define SERVICES_DIR "/etc/ratos/services"
-#define LOGDIR "/var/log"
-#define MAX_SVC 128
-#define MAX_LINE 1024
+static int mod_finit(const char *path);
 
-typedef enum { R_NO=0, R_ON_FAILURE=1, R_ALWAYS=2 } restart_t;
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int (*load)(const char *path);   /* 0 or -errno; bench/modbench.c replaces it */
+    const char *root;    /* MODULES_DIR; benchmarks point it elsewhere */
+    char dir[PATH_MAX];  /* <root>/<release> */
+    char *dep;           /* modules.dep, malloc'd until modules_wait() */
+    const char **index;  /* its lines by module name, open addressing */
+    size_t index_size;   /* power of two */
+    int n, left;         /* modules, modules not done or failed yet */
+    struct {
+        char name[64];
+        const char *path;    /* in dep, up to ':' */
+        int pathlen;
+        int ndeps;
+        short deps[MODULE_DEPS_MAX];
+        mod_state_t state;
+        int err;             /* why it failed; reported by the main thread */
+    } mod[MODULES_MAX];
+    pthread_t workers[MODULE_WORKERS_MAX];
+    int nworkers;
+    uint64_t t0;
+} mods = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .load = mod_finit, .root = MODULES_DIR };
 
-typedef struct service {
-    char name[128];
-    char *execcmd;       /* malloc'd */
-    restart_t restart;
-    pid_t pid;
-    int running;
-    char logfile[256];
-} service;
+/* "kernel/drivers/net/e1000e.ko.zst" -> "e1000e"; '-' and '_' are the same */
+static void mod_name(const char *path, size_t len, char *out, size_t n) {
+    const char *base = path;
+    for (size_t i=0;i<len;i++) if (path[i] == '/') base = path + i + 1;
+    size_t k = 0;
+    for (const char *p = base; p < path + len && k + 1 < n; p++) {
+        if (*p == '.' && strncmp(p, ".ko", 3)==0) break;
+        out[k++] = *p == '-' ? '_' : *p;
+    }
+    out[k] = 0;
+}
 
-static service services[MAX_SVC];
-static int nservices = 0;
-static volatile sig_atomic_t need_reap = 0;
-static volatile sig_atomic_t terminate = 0;
+static int mod_finit(const char *path) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return -errno;
+    /* compressed modules only where the kernel decompresses them itself */
+    const char *ext = strrchr(path, '.');
+    int flags = ext && strcmp(ext, ".ko") != 0 ? MODULE_INIT_COMPRESSED_FILE : 0;
+    int r = (int)syscall(SYS_finit_module, fd, "", flags) == 0 || errno == EEXIST ? 0 : -errno;
+    close(fd);
+    return r;
+}
 
-static void sigchld_handler(int sig) { (void)sig; need_reap = 1; }
-static void sigterm_handler(int sig) { (void)sig; terminate = 1; }
+static size_t mod_hash(const char *name) {
+    size_t h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h;
+}
 
-/* utility: trim */
-static char *trim(char *s) {
-    while(*s==' '||*s=='\t') s++;
-    char *end = s + strlen(s);
-    while(end>s && (end[-1]=='\n' || end[-1]=='\r' || end[-1]==' ' || end[-1]=='\t')) end--;
-    *end = 0;
-    return s;
+/* hash modules.dep lines by module name, once */
+static int mod_index(void) {
+    size_t lines = 0;
+    for (const char *p = mods.dep; *p; p++) lines += *p == '\n';
+    mods.index_size = 64;
+    while (mods.index_size < 2 * lines + 2) mods.index_size *= 2;
+    if (!(mods.index = heap_alloc(mods.index_size * sizeof(char*)))) return -1;
+    memset(mods.index, 0, mods.index_size * sizeof(char*));
+    char n[64];
+    for (const char *p = mods.dep; *p; p += strcspn(p, "\n"), p += *p == '\n') {
+        size_t len = strcspn(p, ":\n");
+        if (p[len] != ':') continue;
+        mod_name(p, len, n, sizeof(n));
+        size_t h = mod_hash(n) & (mods.index_size - 1);
+        while (mods.index[h]) h = (h + 1) & (mods.index_size - 1);
+        mods.index[h] = p;
+    }
+    return 0;
 }
 
-/* parse a simple key=value service file */
-static void parse_service_file(const char *path) {
-    FILE *f = fopen(path, "r");
-    if (!f) return;
-    char line[MAX_LINE];
-    char name[128] = "";
-    char exec[MAX_LINE] = "";
-    char restart[MAX_LINE] = "no";
-    while (fgets(line, sizeof(line), f)) {
-        char *p = strchr(line, '=');
-        if (!p) continue;
-        *p = 0;
-        char *key = trim(line);
-        char *val = trim(p+1);
-        if (strcasecmp(key,"name")==0 || strcasecmp(key,"Name")==0) {
-            strncpy(name, val, sizeof(name)-1);
+static const char *mod_lookup(const char *name) {
+    char n[64];
+    for (size_t h = mod_hash(name) & (mods.index_size - 1); mods.index[h]; h = (h + 1) & (mods.index_size - 1)) {
+        mod_name(mods.index[h], strcspn(mods.index[h], ":"), n, sizeof(n));
+        if (strcmp(n, name)==0) return mods.index[h];
+    }
+    return NULL;
+}
+
+/* index of a module, added with everything it depends on; -1 if unknown */
+static int mod_add(const char *name) {
+    for (int i=0;i<mods.n;i++) if (strcmp(mods.mod[i].name, name)==0) return i;
+    const char *p = mod_lookup(name);
+    if (!p || mods.n >= MODULES_MAX) return -1;
+    int i = mods.n++;
+    size_t len = strcspn(p, ":");
+    snprintf(mods.mod[i].name, sizeof(mods.mod[i].name), "%s", name);
+    mods.mod[i].path = p;
+    mods.mod[i].pathlen = (int)len;
+    /* the list is already the transitive closure */
+    char n[64];
+    for (const char *d = p + len + 1; *d && *d != '\n'; ) {
+        d += strspn(d, " \t");
+        size_t dl = strcspn(d, " \t\n");
+        if (!dl) break;
+        mod_name(d, dl, n, sizeof(n));
+        int k = mod_add(n);
+        if (k >= 0 && mods.mod[i].ndeps < MODULE_DEPS_MAX) mods.mod[i].deps[mods.mod[i].ndeps++] = (short)k;
+        d += dl;
+    }
+    return i;
+}
+
+/* the module names of one list file, or a comma-separated ratos.modules= */
+static void mod_add_list(char *text, const char *seps) {
+    for (char *w = strtok(text, seps); w; w = strtok(NULL, seps)) {
+        w = trim(w);
+        if (!*w || *w == '#' || *w == ';') continue;
+        char name[64];
+        mod_name(w, strlen(w), name, sizeof(name));
+        if (mod_add(name) < 0) console(CON_WARN, "module %s: not in modules.dep (built in?)", name);
+    }
+}
+
+/* read a whole file into a NUL-terminated heap buffer */
+static char *read_file(const char *path) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fd, &st) == 0 && (buf = heap_alloc((size_t)st.st_size + 1))) {
+        ssize_t n = read(fd, buf, (size_t)st.st_size);
+        buf[n > 0 ? n : 0] = 0;
+    }
+    close(fd);
+    return buf;
+}
+
+/* fail every waiting module with a failed dependency, transitively;
+ * returns how many were failed. Called with mods.lock held. */
+static int mod_fail_dependents(void) {
+    int failed = 0, more = 1;
+    while (more) {
+        more = 0;
+        for (int i=0;i<mods.n;i++) {
+            if (mods.mod[i].state != MOD_WAITING) continue;
+            for (int k=0;k<mods.mod[i].ndeps;k++) {
+                if (mods.mod[mods.mod[i].deps[k]].state != MOD_FAILED) continue;
+                mods.mod[i].state = MOD_FAILED;
+                mods.mod[i].err = MOD_ERR_DEP;
+                mods.left--;
+                failed++;
+                more = 1;
+                break;
+            }
         }
-        else if (strcasecmp(key,"execstart")==0 || strcasecmp(key,"ExecStart")==0) {
-            strncpy(exec, val, sizeof(exec)-1);
+    }
+    if (failed) pthread_cond_broadcast(&mods.cond);
+    return failed;
+}
+
+static void *mod_worker(void *arg) {
+    (void)arg;
+    char path[PATH_MAX];
+    pthread_mutex_lock(&mods.lock);
+    while (mods.left) {
+        int pick = -1, loading = 0;
+        for (int i=0;i<mods.n && pick < 0;i++) {
+            if (mods.mod[i].state == MOD_LOADING) loading++;
+            if (mods.mod[i].state != MOD_WAITING) continue;
+            int ready = 1;
+            for (int k=0;k<mods.mod[i].ndeps && ready;k++)
+                ready = mods.mod[mods.mod[i].deps[k]].state == MOD_DONE;
+            if (ready) pick = i;
         }
-        else if (strcasecmp(key,"restart")==0 || strcasecmp(key,"Restart")==0) {
-            strncpy(restart, val, sizeof(restart)-1);
+        if (pick < 0) {
+            if (loading) {
+                pthread_cond_wait(&mods.cond, &mods.lock);
+            } else if (!mod_fail_dependents()) {
+                /* nothing loading and nothing ready: a cycle; give up on the rest */
+                for (int i=0;i<mods.n;i++) if (mods.mod[i].state == MOD_WAITING) {
+                    mods.mod[i].state = MOD_FAILED;
+                    mods.mod[i].err = MOD_ERR_CYCLE;
+                    mods.left--;
+                }
+                pthread_cond_broadcast(&mods.cond);
+            }
+            continue;
         }
+        mods.mod[pick].state = MOD_LOADING;
+        pthread_mutex_unlock(&mods.lock);
+        const char *p = mods.mod[pick].path;
+        size_t at = p[0] == '/' ? 0 : (size_t)snprintf(path, sizeof(path), "%s/", mods.dir);
+        size_t len = (size_t)mods.mod[pick].pathlen;
+        int r = -ENAMETOOLONG;
+        if (at + len < sizeof(path)) {
+            memcpy(path + at, p, len);
+            path[at + len] = 0;
+            r = mods.load(path);
+        }
+        pthread_mutex_lock(&mods.lock);
+        mods.mod[pick].state = r == 0 ? MOD_DONE : MOD_FAILED;
+        mods.mod[pick].err = r;
+        mods.left--;
+        if (r) mod_fail_dependents();
+        pthread_cond_broadcast(&mods.cond);
     }
-    fclose(f);
-    if (name[0]==0 || exec[0]==0) return;
-    if (nservices >= MAX_SVC) return;
-    service *s = &services[nservices++];
-    memset(s,0,sizeof(service));
-    strncpy(s->name, name, sizeof(s->name)-1);
-    s->execcmd = strdup(exec);
-    s->restart = R_NO;
-    if (strcasecmp(restart,"always")==0) s->restart = R_ALWAYS;
-    else if (strcasecmp(restart,"on-failure")==0) s->restart = R_ON_FAILURE;
-    snprintf(s->logfile, sizeof(s->logfile), LOGDIR "/%s.log", s->name);
+    pthread_mutex_unlock(&mods.lock);
+    return NULL;
 }
 
-/* scan services directory */
-static void load_services(void) {
-    DIR *d = opendir(SERVICES_DIR);
-    if (!d) return;
-    struct dirent *e;
-    while ((e = readdir(d))) {
-        if (e->d_type == DT_DIR) continue;
-        if (e->d_name[0]=='.') continue;
-        char path[512];
-        snprintf(path, sizeof(path), SERVICES_DIR "/%s", e->d_name);
-        parse_service_file(path);
+/* modules.dep, read and indexed on first need */
+static int mod_deps(const char *path) {
+    if (mods.index) return 0;
+    if ((mods.dep || (mods.dep = read_file(path))) && mod_index() == 0) return 0;
+    console(CON_WARN, "cannot read %s: not loading modules", path);
+    return -1;
+}
+
+/* boot: read the lists and modules.dep, start the workers */
+MAIN_USED static void modules_start(void) {
+    char seen[MODULE_LISTS_MAX][NAME_MAX + 1];
+    int nseen = 0, seen_full = 0;
+    struct utsname u;
+    if (uname(&u) < 0) return;
+    snprintf(mods.dir, sizeof(mods.dir), "%s/%s", mods.root, u.release);
+    char path[sizeof(mods.dir) + 16];
+    snprintf(path, sizeof(path), "%s/modules.dep", mods.dir);
+    mods.t0 = clock_usec(CLOCK_MONOTONIC);
+    /* a list in /etc hides the one of the same name further down */
+    for (size_t i=0;i<sizeof(modules_load_dirs)/sizeof(modules_load_dirs[0]);i++) {
+        DIR *d = opendir(modules_load_dirs[i]);
+        if (!d) continue;
+        struct dirent *e;
+        while ((e = readdir(d))) {
+            size_t len = strlen(e->d_name);
+            if (len < 6 || strcmp(e->d_name + len - 5, ".conf") != 0) continue;
+            int dup = 0;
+            for (int k=0;k<nseen && !dup;k++) dup = strcmp(seen[k], e->d_name)==0;
+            if (dup) continue;
+            if (nseen < MODULE_LISTS_MAX) snprintf(seen[nseen++], sizeof(seen[0]), "%s", e->d_name);
+            else if (!seen_full++)
+                console(CON_WARN, "modules-load.d: over %d lists; from %s on, same-named lists further down are read too",
+                        MODULE_LISTS_MAX, e->d_name);
+            if (mod_deps(path) < 0) {
+                closedir(d);
+                return;
+            }
+            char list[PATH_MAX];
+            snprintf(list, sizeof(list), "%s/%s", modules_load_dirs[i], e->d_name);
+            char *text = read_file(list);
+            if (text) mod_add_list(text, "\n");
+            free(text);
+        }
+        closedir(d);
     }
-    closedir(d);
+    if (boot_modules) {
+        if (mod_deps(path) < 0) return;
+        char list[MAX_LINE];
+        snprintf(list, sizeof(list), "%s", boot_modules);
+        mod_add_list(list, ",");
+    }
+    if (mods.n == 0) return;
+    mods.left = mods.n;
+    int want = module_workers;
+    if (want <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        want = ncpu > 0 ? (int)ncpu : 1;
+    }
+    if (want > MODULE_WORKERS_MAX) want = MODULE_WORKERS_MAX;
+    if (want > mods.n) want = mods.n;
+    while (mods.nworkers < want && pthread_create(&mods.workers[mods.nworkers], NULL, mod_worker, NULL) == 0)
+        mods.nworkers++;
+    /* no threads at all: load them here, one at a time */
+    if (mods.nworkers == 0) mod_worker(NULL);
+    trace("modules: %d to load, %d workers", mods.n, mods.nworkers);
+}
+
+/* boot: wait for the workers, before any service starts */
+MAIN_USED static void modules_wait(void) {
+    if (mods.n == 0) return;
+    for (int i=0;i<mods.nworkers;i++) pthread_join(mods.workers[i], NULL);
+    int failed = 0;
+    for (int i=0;i<mods.n;i++) {
+        if (mods.mod[i].state == MOD_DONE) continue;
+        failed++;
+        console(CON_WARN, "module %s: %s", mods.mod[i].name,
+                mods.mod[i].err == MOD_ERR_DEP ? "a dependency failed" :
+                mods.mod[i].err == MOD_ERR_CYCLE ? "circular dependency" : strerror(-mods.mod[i].err));
+    }
+    uint64_t ms = (clock_usec(CLOCK_MONOTONIC) - mods.t0) / 1000;
+    console(CON_INFO, "loaded %d modules in %llu ms (%d workers)%s", mods.n - failed, (unsigned long long)ms,
+            mods.nworkers, failed ? ", some failed" : "");
+    trace("modules done");
+    free(mods.dep);
+    free(mods.index);
+    mods.dep = NULL;
+    mods.index = NULL;
+}
+
+/*
+ * Sandboxing. Namespaces come from clone3() flags so the child is born in
+ * them; mounts are then set up in the child before credentials are dropped.
+ */
+static uint64_t sandbox_clone_flags(service *s) {
+    uint64_t flags = 0;
+    if (s->private_tmp || s->protect_system || s->ro_paths || s->rootdir) flags |= CLONE_NEWNS;
+    if (s->private_network) flags |= CLONE_NEWNET;
+    return flags;
+}
+
+/* fork() into new namespaces; falls back to fork()+unshare() without clone3 */
+static pid_t spawn_process(uint64_t flags) {
+    if (!flags) return fork();
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = flags;
+    args.exit_signal = SIGCHLD;
+    pid_t pid = (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+    if (pid >= 0 || errno != ENOSYS) return pid;
+    pid = fork();
+    if (pid == 0 && unshare((int)flags) < 0) { perror("unshare"); _exit(126); }
+    return pid;
+}
+
+/* set (or clear) read-only on the mount at path and everything below it */
+static int mount_readonly(const char *path, int ro) {
+    struct mount_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    if (ro) attr.attr_set = MOUNT_ATTR_RDONLY; else attr.attr_clr = MOUNT_ATTR_RDONLY;
+    if (syscall(SYS_mount_setattr, AT_FDCWD, path, AT_RECURSIVE, &attr, sizeof(attr)) == 0) return 0;
+    /* pre-5.12 kernels: top mount only */
+    return mount(NULL, path, NULL, MS_BIND|MS_REMOUNT|(ro ? MS_RDONLY : 0), NULL);
+}
+
+static int bind_readonly(const char *path, int optional) {
+    if (mount(path, path, NULL, MS_BIND|MS_REC, NULL) < 0) {
+        if (optional && errno == ENOENT) return 0;
+        return -1;
+    }
+    return mount_readonly(path, 1);
+}
+
+static void loopback_up(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+    if (fd < 0) return;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, "lo");
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0) {
+        ifr.ifr_flags |= IFF_UP;
+        ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+    close(fd);
+}
+
+/* in the child: returns -1 (errno set) if the sandbox cannot be built */
+static int sandbox_setup(service *s) {
+    if (s->private_network) loopback_up();
+    if (!(sandbox_clone_flags(s) & CLONE_NEWNS)) return 0;
+    /* keep our mounts from propagating back to the host */
+    if (mount(NULL, "/", NULL, MS_REC|MS_PRIVATE, NULL) < 0) return -1;
+    if (s->rootdir && (chroot(s->rootdir) < 0 || chdir("/") < 0)) return -1;
+    if (s->protect_system == PS_STRICT) {
+        if (mount("/", "/", NULL, MS_BIND|MS_REC, NULL) < 0 || mount_readonly("/", 1) < 0) return -1;
+        /* API filesystems stay writable */
+        static const char *api[] = { "/dev", "/proc", "/sys", "/run" };
+        for (size_t i=0;i<sizeof(api)/sizeof(api[0]);i++) mount_readonly(api[i], 0);
+    } else if (s->protect_system) {
+        if (bind_readonly("/usr", 1) < 0 || bind_readonly("/boot", 1) < 0) return -1;
+        if (s->protect_system == PS_FULL && bind_readonly("/etc", 1) < 0) return -1;
+    }
+    for (char **p = s->ro_paths; p && *p; p++)
+        if (bind_readonly(**p == '-' ? *p + 1 : *p, **p == '-') < 0) return -1;
+    if (s->private_tmp) {
+        if (mount("tmpfs", "/tmp", "tmpfs", MS_NOSUID|MS_NODEV, "mode=1777") < 0) return -1;
+        mount("tmpfs", "/var/tmp", "tmpfs", MS_NOSUID|MS_NODEV, "mode=1777");
+    }
+    return 0;
+}
+
+/*
+ * In the child, before credentials change: shrink the bounding set (needs
+ * CAP_SETPCAP, so root) and keep permitted capabilities over setresuid()
+ * when ambient ones are wanted.
+ */
+static int caps_bound(service *s) {
+    if (s->cap_bounding != ~0ULL) {
+        for (int cap=0;cap<64;cap++) {
+            if (s->cap_bounding & (1ULL << cap)) continue;
+            /* EINVAL: the kernel has no such capability */
+            if (prctl(PR_CAPBSET_DROP, cap, 0, 0, 0) < 0 && errno != EINVAL) return -1;
+        }
+    }
+    if (s->cap_ambient && s->creds && prctl(PR_SET_KEEPCAPS, 1, 0, 0, 0) < 0) return -1;
+    return 0;
+}
+
+/* after credentials change: make the ambient set inheritable and raise it */
+static int caps_ambient(service *s) {
+    if (!s->cap_ambient) return 0;
+    struct __user_cap_header_struct hdr = { _LINUX_CAPABILITY_VERSION_3, 0 };
+    struct __user_cap_data_struct data[2];
+    if (syscall(SYS_capget, &hdr, data) < 0) return -1;
+    for (int i=0;i<2;i++) {
+        uint32_t want = (uint32_t)(s->cap_ambient >> (32*i));
+        data[i].inheritable = want;
+        data[i].effective = want & data[i].permitted;
+    }
+    if (syscall(SYS_capset, &hdr, data) < 0) return -1;
+    for (int cap=0;cap<64;cap++)
+        if ((s->cap_ambient & (1ULL << cap)) && prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_RAISE, cap, 0, 0) < 0)
+            return -1;
+    return 0;
+}
+
+/* in the child, last thing before execve() */
+static int seccomp_install(service *s) {
+    struct sock_fprog prog = { s->seccomp_len, s->seccomp };
+    if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog) == 0) return 0;
+    if (errno != EACCES) return -1;
+    /* without CAP_SYS_ADMIN (User= dropped it) the kernel wants no_new_privs */
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) return -1;
+    return (int)syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog);
+}
+
+/* in the child, after setsid() so a tty on stdin becomes the controlling one */
+static int stdio_setup(service *s) {
+    for (int fd=0;fd<3;fd++) {
+        const char *path = s->std_path ? s->std_path[fd] : NULL;
+        int src;
+        switch (s->std[fd]) {
+        case STD_TTY:
+            src = open(s->tty_path ? s->tty_path : "/dev/console", (fd ? O_WRONLY : O_RDWR)|O_NOCTTY);
+            if (fd == 0 && src >= 0) ioctl(src, TIOCSCTTY, 0);
+            break;
+        case STD_FILE:
+            src = open(path, fd ? O_WRONLY|O_CREAT : O_RDONLY, 0644);
+            break;
+        case STD_APPEND:
+            src = open(path, O_WRONLY|O_CREAT|O_APPEND, 0644);
+            break;
+        case STD_INHERIT:
+            /* stdout takes stdin's file, stderr stdout's; inherit all the
+             * way back (container main command) keeps init's own */
+            if (fd == 0 || s->std[fd-1] == STD_INHERIT) continue;
+            src = dup(fd - 1);
+            break;
+        case STD_JOURNAL:
+            if (s->outw >= 0) { src = dup(s->outw); break; }
+            /* no capture pipe: straight to the logfile */
+            src = open(s->logfile, O_CREAT|O_WRONLY|O_APPEND, 0644);
+            break;
+        default:
+            src = open("/dev/null", fd ? O_WRONLY : O_RDONLY);
+            break;
+        }
+        if (src < 0) return -1;
+        if (src != fd) { dup2(src, fd); close(src); }
+    }
+    return 0;
+}
+
+/* the supervisor's own memory and CPU priority; see the header. Without
+ * the privilege (a container, usually) it runs unprotected. */
+MAIN_USED static void protect_self(void) {
+    int locked = 0;
+    if (boot_protect) {
+        locked = mlockall(MCL_CURRENT|MCL_FUTURE|MCL_ONFAULT) == 0 || mlockall(MCL_CURRENT|MCL_FUTURE) == 0;
+        int fd = open("/proc/self/oom_score_adj", O_WRONLY|O_CLOEXEC);
+        if (fd >= 0) {
+            self_protected = write(fd, "-1000", 5) == 5;
+            close(fd);
+        }
+    }
+    struct sched_param sp = { .sched_priority = boot_rtprio };
+    if (boot_rtprio > 0) {
+        if (sched_setscheduler(0, SCHED_FIFO|SCHED_RESET_ON_FORK, &sp) < 0) console_perror("ratos.rtprio");
+    } else if (boot_nice < 0) {
+        if (sched_setscheduler(0, SCHED_OTHER|SCHED_RESET_ON_FORK, &sp) < 0 ||
+            setpriority(PRIO_PROCESS, 0, boot_nice) < 0) console_perror("ratos.nice");
+    }
+    debug("protect: mlockall %s, oom_score_adj %s, %s %d", locked ? "yes" : "no", self_protected ? "-1000" : "unchanged",
+          boot_rtprio > 0 ? "rtprio" : "nice", boot_rtprio > 0 ? boot_rtprio : boot_nice);
+}
+
+/* in a child of init: the OOM killer may pick it like any other process */
+static void oom_reset(void) {
+    if (!self_protected) return;
+    int fd = open("/proc/self/oom_score_adj", O_WRONLY|O_CLOEXEC);
+    if (fd >= 0) {
+        (void)!write(fd, "0", 1);
+        close(fd);
+    }
+}
+
+/* child side of a start: set up the process and exec the service */
+static void exec_service(service *s) {
+    /* set child process group */
+    setsid();
+    oom_reset();
+    /* before sandbox_setup(): stdio paths are on the host, not in RootDirectory= */
+    if (stdio_setup(s) < 0) {
+        perror("stdio");
+        _exit(126);
+    }
+    struct rlimit core = { 0, 0 };
+    if (s->coredump_max) core.rlim_cur = core.rlim_max = RLIM_INFINITY;
+    setrlimit(RLIMIT_CORE, &core);
+    if (sandbox_setup(s) < 0) {
+        perror("sandbox");
+        _exit(126);
+    }
+    if (caps_bound(s) < 0) {
+        perror("capability bounding set");
+        _exit(126);
+    }
+    /* drop privileges last, so everything above still runs as root */
+    if (s->creds && (setgroups((size_t)s->ngroups, s->groups) < 0 ||
+                     setresgid(s->gid, s->gid, s->gid) < 0 ||
+                     setresuid(s->uid, s->uid, s->uid) < 0)) {
+        perror("set credentials");
+        _exit(126);
+    }
+    if (caps_ambient(s) < 0) {
+        perror("ambient capabilities");
+        _exit(126);
+    }
+    if (s->no_new_privs && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+        perror("no_new_privs");
+        _exit(126);
+    }
+    if (s->seccomp && seccomp_install(s) < 0) {
+        perror("seccomp");
+        _exit(126);
+    }
+    /* exec directly, or via /bin/sh -c if execcmd is composite */
+    extern char **environ;
+    char **envp = s->envp ? s->envp : environ;
+    if (s->argv) execve(s->argv[0], s->argv, envp);
+    char *sh[] = { "sh", "-c", s->execcmd, NULL };
+    execve("/bin/sh", sh, envp);
+    /* if execve fails */
+    perror("execve");
+    _exit(127);
+}
+
+/* real backend: clone3()/fork(), then exec in the child */
+static pid_t sys_spawn(service *s) {
+    pid_t pid = spawn_process(sandbox_clone_flags(s));
+    if (pid == 0) exec_service(s);
+    return pid;
 }
 
-/* start a service, redirecting stdout+stderr to logfile */
+/* parent side of a start: checks, capture pipe, spawn, bookkeeping */
 static void start_service(service *s) {
     if (!s || !s->execcmd) return;
-    pid_t pid = fork();
-    if (pid < 0) {
-        perror("fork");
+    if (s->cred_error) {
+        console(CON_WARN, "not starting %s: bad User=/Group=", s->name);
         return;
     }
-    if (pid == 0) {
-        /* child */
-        /* reopen /dev/null for stdin */
-        int fdnull = open("/dev/null", O_RDONLY);
-        if (fdnull >= 0) { dup2(fdnull, 0); close(fdnull); }
-        /* open logfile */
-        int fdlog = open(s->logfile, O_CREAT|O_WRONLY|O_APPEND, 0644);
-        if (fdlog >= 0) { dup2(fdlog, 1); dup2(fdlog, 2); if (fdlog>2) close(fdlog); }
-        /* set child process group */
-        setsid();
-        /* exec via /bin/sh -c so execcmd can be composite */
-        execl("/bin/sh", "sh", "-c", s->execcmd, (char*)NULL);
-        /* if execl fails */
-        perror("execl");
-        _exit(127);
-    } else {
-        s->pid = pid;
-        s->running = 1;
-        printf("[init] started %s pid=%d\n", s->name, pid);
+    if (s->seccomp_error) {
+        console(CON_WARN, "not starting %s: bad SystemCallFilter=", s->name);
+        return;
     }
+    if (s->nenvfiles && env_files_changed(s)) build_env(s);
+    if (s->outr < 0 && (s->std[1] == STD_JOURNAL || s->std[2] == STD_JOURNAL)) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) == 0) {
+            fcntl(p[0], F_SETFL, O_NONBLOCK);
+            s->outr = p[0];
+            s->outw = p[1];
+            ncapture++;
+        }
+    }
+    pid_t pid = sys->spawn(s);
+    if (pid < 0) {
+        console_perror("fork");
+        return;
+    }
+    s->pid = pid;
+    s->running = 1;
+    if (s == main_svc) main_pid = pid;
+    console(CON_INFO, "started %s pid=%d", s->name, pid);
+    trace("start %s pid=%d", s->name, pid);
 }
 
 /* stop a service (SIGTERM then SIGKILL) */
-static void stop_service(service *s) {
+MAIN_USED static void stop_service(service *s) {
     if (!s || !s->running) return;
-    kill(-s->pid, SIGTERM); /* send to group */
+    sys->kill(-s->pid, SIGTERM); /* send to group */
     /* wait up to a little while */
     int i;
     for (i=0;i<50;i++) {
-        if (waitpid(s->pid, NULL, WNOHANG) == s->pid) break;
-        usleep(100000);
+        if (sys->waitpid(s->pid, NULL, WNOHANG) == s->pid) break;
+        sys->sleep(100000);
     }
-    if (waitpid(s->pid, NULL, WNOHANG) != s->pid) {
-        kill(-s->pid, SIGKILL);
+    if (sys->waitpid(s->pid, NULL, WNOHANG) != s->pid) {
+        sys->kill(-s->pid, SIGKILL);
     }
     s->running = 0;
-    printf("[init] stopped %s pid=%d\n", s->name, s->pid);
+    console(CON_INFO, "stopped %s pid=%d", s->name, s->pid);
+    trace("stop %s pid=%d", s->name, s->pid);
+}
+
+/* start again after an exit; RATOS_RESTARTS counts these */
+static void restart_service(service *s) {
+    s->restart_at = 0;
+    s->restarts++;
+    if (s->restarts_env) snprintf(s->restarts_env, RESTARTS_ENV_SIZE, "RATOS_RESTARTS=%u", s->restarts);
+    start_service(s);
+}
+
+/* restart services whose backoff has ended; returns the next deadline */
+MAIN_USED static uint64_t start_restarts(void) {
+    if (restartq.head == restartq.tail) return UINT64_MAX;
+    uint64_t now = sys->clock(CLOCK_MONOTONIC);
+    while (restartq.head != restartq.tail) {
+        service *s = &services[restartq.svc[restartq.head % MAX_SVC]];
+        if (s->restart_at > now) return s->restart_at;
+        restartq.head++;
+        restart_service(s);
+    }
+    return UINT64_MAX;
 }
 
 /* supervise reaped child */
@@ -165,12 +2793,30 @@ static void handle_reaped(pid_t pid, int status) {
         service *s = &services[i];
         if (s->running && s->pid == pid) {
             s->running = 0;
-            printf("[init] service %s exited pid=%d status=%d\n", s->name, pid, status);
+            boot_exited = 1;
+            console(CON_INFO, "service %s exited pid=%d status=%d", s->name, pid, status);
+            trace("exit %s pid=%d status=%d", s->name, pid, status);
             int exitcode = -1;
             if (WIFEXITED(status)) exitcode = WEXITSTATUS(status);
-            if (s->restart == R_ALWAYS || (s->restart == R_ON_FAILURE && exitcode != 0)) {
-                sleep(1); /* backoff */
-                start_service(s);
+            if (s == main_svc) main_pid = 0;
+            if ((s->restart == R_ALWAYS || (s->restart == R_ON_FAILURE && exitcode != 0)) &&
+                !(s == main_svc && main_stopping)) {
+                debug("%s: restarting (Restart=%s, exit code %d), restart #%u", s->name,
+                      s->restart == R_ALWAYS ? "always" : "on-failure", exitcode, s->restarts + 1);
+                if (RESTART_BACKOFF_USEC) {
+                    /* backoff: the main loop restarts it, and keeps draining logs meanwhile */
+                    s->restart_at = sys->clock(CLOCK_MONOTONIC) + RESTART_BACKOFF_USEC;
+                    restartq.svc[restartq.tail++ % MAX_SVC] = i;
+                } else {
+                    restart_service(s);
+                }
+            } else if (container_mode && s == main_svc) {
+                /* the container lives as long as its main service */
+                main_status = WIFEXITED(status) ? exitcode : 128 + WTERMSIG(status);
+                terminate = 1;
+            } else {
+                debug("%s: not restarting (Restart=%s, exit code %d)", s->name,
+                      s->restart == R_ALWAYS ? "always" : s->restart == R_ON_FAILURE ? "on-failure" : "no", exitcode);
             }
             return;
         }
@@ -178,82 +2824,422 @@ static void handle_reaped(pid_t pid, int status) {
     /* if not a supervised service, maybe it was the login child - ignore */
 }
 
-/* spawn login on tty1 (simple: open /dev/tty1 and dup2) */
-static void spawn_getty_or_shell() {
-    pid_t pid = fork();
-    if (pid < 0) return;
-    if (pid == 0) {
-        /* Child: open /dev/tty1 */
-        int fd = open("/dev/tty1", O_RDWR);
-        if (fd < 0) {
-            /* fallback to /dev/console or stdio */
-            fd = open("/dev/console", O_RDWR);
-            if (fd < 0) {
-                /* fallback to stdout/stderr unchanged */
+/* SIGUSR1: counters on the console */
+MAIN_USED static void print_stats(void) {
+    int running = 0;
+    unsigned long restarts = 0;
+    for (int i=0;i<nservices;i++) {
+        running += services[i].running;
+        restarts += services[i].restarts;
+    }
+    console(CON_NOTICE, "stats: services=%d running=%d restarts=%lu heap_allocs=%lu since_load=%lu console_dropped=%lu",
+            nservices, running, restarts, heap_allocs, heap_allocs - heap_allocs_loaded, con.dropped);
+}
+
+/* boot: start the next ratos.max_parallel= services once a service has
+ * exited or BOOT_BATCH_USEC has passed; returns when the next batch is due */
+MAIN_USED static uint64_t start_pending(void) {
+    if (boot_next >= nservices) return UINT64_MAX;
+    if (max_parallel) {
+        uint64_t now = sys->clock(CLOCK_MONOTONIC);
+        if (now < boot_batch_at && !boot_exited) return boot_batch_at;
+        boot_batch_at = now + BOOT_BATCH_USEC;
+        boot_exited = 0;
+    }
+    for (int n = 0; boot_next < nservices && (!max_parallel || n < max_parallel); n++)
+        start_service(&services[boot_next++]);
+    if (boot_next < nservices) return boot_batch_at;
+    trace("all %d services started", nservices);
+    return UINT64_MAX;
+}
+
+/* reap all children */
+MAIN_USED static void reap_children(void) {
+    int status;
+    pid_t pid;
+    while ((pid = sys->waitpid(-1, &status, WNOHANG)) > 0) {
+        handle_reaped(pid, status);
+    }
+}
+
+/*
+ * Core dumps. init registers itself as the core_pattern pipe handler; the
+ * kernel runs "init --coredump <pid> <sig> <time> <services dir> <comm>"
+ * with the core on stdin. The crashing process stays in /proc until the
+ * helper closes stdin (thanks to core_pipe_limit), so its environment
+ * tells us which service it was; the helper closes it as soon as the core
+ * is spooled, and compresses afterwards.
+ */
+MAIN_USED static void setup_coredump(void) {
+    char exe[256];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+    if (n <= 0) return;
+    exe[n] = 0;
+    int fd = open("/proc/sys/kernel/core_pattern", O_WRONLY|O_CLOEXEC);
+    if (fd < 0) return;
+    /* core_pattern splits arguments at spaces; "-" is the default dir */
+    const char *dir = services_dir[0] == '/' && !strpbrk(services_dir, " \t") ? services_dir : "-";
+    dprintf(fd, "|%s --coredump %%P %%s %%t %s %%e", exe, dir);
+    close(fd);
+    fd = open("/proc/sys/kernel/core_pipe_limit", O_WRONLY|O_CLOEXEC);
+    if (fd >= 0) { dprintf(fd, "%d", COREDUMP_PIPE_LIMIT); close(fd); }
+}
+
+/* RATOS_SERVICE / RATOS_RESTARTS from the crashing process's environment */
+static void coredump_identify(pid_t pid, char *name, size_t namelen, unsigned *restarts) {
+    char path[64], env[65536];
+    snprintf(path, sizeof(path), "/proc/%d/environ", pid);
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, env, sizeof(env)-1);
+    close(fd);
+    if (n <= 0) return;
+    env[n] = 0;
+    for (char *p = env; p < env + n; p += strlen(p) + 1) {
+        if (strncmp(p, "RATOS_SERVICE=", 14)==0) snprintf(name, namelen, "%s", p+14);
+        else if (strncmp(p, "RATOS_RESTARTS=", 15)==0) *restarts = (unsigned)strtoul(p+15, NULL, 10);
+    }
+}
+
+/* delete the oldest dumps in dir (other than 'keep') until at most 'budget'
+ * bytes remain; returns the bytes remaining */
+static uint64_t coredump_prune(const char *dir, const char *keep, uint64_t budget) {
+    for (;;) {
+        DIR *d = opendir(dir);
+        if (!d) return 0;
+        uint64_t total = 0;
+        char oldest[256] = "";
+        time_t oldest_t = 0;
+        struct dirent *e;
+        while ((e = readdir(d))) {
+            if (e->d_name[0]=='.' || strcmp(e->d_name, keep)==0) continue;
+            struct stat st;
+            if (fstatat(dirfd(d), e->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)) continue;
+            total += (uint64_t)st.st_size;
+            if (!oldest[0] || st.st_mtime < oldest_t) {
+                snprintf(oldest, sizeof(oldest), "%s", e->d_name);
+                oldest_t = st.st_mtime;
             }
         }
-        if (fd >= 0) {
-            dup2(fd, 0);
-            dup2(fd, 1);
-            dup2(fd, 2);
-            if (fd > 2) close(fd);
-        }
-        /* try /bin/login, else start shell */
-        execl("/bin/login", "login", (char*)NULL);
-        execl("/bin/sh", "sh", "-l", (char*)NULL);
+        if (total <= budget || !oldest[0]) { closedir(d); return total; }
+        unlinkat(dirfd(d), oldest, 0);
+        closedir(d);
+    }
+}
+
+/* compress the spooled core into path, keeping the dumps in dir within
+ * quota; returns the bytes written, or -1 if over quota or it failed */
+static int64_t coredump_compress(int spool, const char *cpath, const char *dir, const char *file,
+                                 const char *path, uint64_t quota) {
+    int p[2];
+    if (pipe(p) < 0) return -1;
+    pid_t cpid = fork();
+    if (cpid == 0) {
+        dup2(spool, 0);
+        dup2(p[1], 1);
+        close(p[0]); close(p[1]);
+        execl(cpath, cpath, "-1", "-c", (char*)NULL);
         _exit(127);
     }
-    else {
-        /* parent: optionally monitor this pid or let system supervise it via service file */
-        int st;
-        waitpid(pid, &st, 0);
-        /* if login exited, loop to respawn */
+    close(p[1]);
+    if (cpid < 0) { close(p[0]); return -1; }
+    uint64_t others = coredump_prune(dir, file, quota);
+    int out = open(path, O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0640);
+    uint64_t written = 0;
+    int over = out < 0;
+    char buf[65536];
+    ssize_t r;
+    while (!over && (r = read(p[0], buf, sizeof(buf))) > 0) {
+        written += (uint64_t)r;
+        if (others + written > quota) {
+            others = written < quota ? coredump_prune(dir, file, quota - written) : 0;
+            if (others + written > quota) { over = 1; break; }
+        }
+        write_all(out, buf, (size_t)r);
+    }
+    close(p[0]);
+    int st = 0;
+    waitpid(cpid, &st, 0);
+    if (out >= 0) close(out);
+    if (over || !WIFEXITED(st) || WEXITSTATUS(st) != 0) { unlink(path); return -1; }
+    return (int64_t)written;
+}
+
+MAIN_USED static int coredump_main(int argc, char **argv) {
+    if (argc < 7) return 1;
+    pid_t pid = (pid_t)atoi(argv[2]);
+    int sig = atoi(argv[3]);
+    long t = atol(argv[4]);
+    if (strcmp(argv[5], "-") != 0) services_dir = argv[5];
+
+    char name[128];
+    unsigned restarts = 0;
+    /* comm (argv[6] on, %e may contain spaces), if not a service */
+    size_t nl = 0;
+    name[0] = 0;
+    for (int i=6;i<argc && nl < sizeof(name)-1;i++)
+        nl += (size_t)snprintf(name+nl, sizeof(name)-nl, i>6 ? " %s" : "%s", argv[i]);
+    coredump_identify(pid, name, sizeof(name), &restarts);
+    for (char *p = name; *p; p++) if (*p == '/') *p = '_';
+    if (name[0] == '.') name[0] = '_';
+
+    uint64_t quota = COREDUMP_MAX_DEFAULT;
+    load_services();
+    for (int i=0;i<nservices;i++)
+        if (strcmp(services[i].name, name)==0) quota = services[i].coredump_max;
+    if (quota == 0) return 0;
+
+    char dir[256], file[96], path[384], spool[384];
+    mkdir("/var/lib", 0755); mkdir("/var/lib/ratos", 0755); mkdir(COREDUMP_DIR, 0755);
+    snprintf(dir, sizeof(dir), COREDUMP_DIR "/%s", name);
+    mkdir(dir, 0755);
+
+    /* compress through whatever is installed, or store the core as is */
+    static const struct { const char *path, *ext; } comp[] = {
+        { "/usr/bin/zstd", ".zst" }, { "/bin/zstd", ".zst" },
+        { "/usr/bin/gzip", ".gz" },  { "/bin/gzip", ".gz" },
+    };
+    const char *cpath = NULL, *ext = "";
+    for (size_t i=0;i<sizeof(comp)/sizeof(comp[0]);i++)
+        if (access(comp[i].path, X_OK)==0) { cpath = comp[i].path; ext = comp[i].ext; break; }
+
+    /* spool the raw core at normal priority and let go of the crashed
+     * process; prune skips dot files, so the spool is not counted */
+    snprintf(spool, sizeof(spool), "%s/.%ld-%d.spool", dir, t, pid);
+    int sfd = open(spool, O_CREAT|O_RDWR|O_TRUNC|O_CLOEXEC, 0600);
+    if (sfd < 0) return 1;
+    uint64_t limit = cpath ? quota * COREDUMP_SPOOL_RATIO : quota, raw = 0;
+    int over = 0;
+    char buf[65536];
+    ssize_t r;
+    while ((r = read(0, buf, sizeof(buf))) > 0) {
+        if (raw + (uint64_t)r > limit) { over = 1; break; }
+        write_all(sfd, buf, (size_t)r);
+        raw += (uint64_t)r;
+    }
+    /* let go of the crashed process; keep fd 0 taken for the pipe below */
+    int nfd = open("/dev/null", O_RDONLY);
+    if (nfd > 0) { dup2(nfd, 0); close(nfd); }
+    else if (nfd < 0) close(0);
+
+    /* the rest never competes with the services being restarted */
+    syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, 0, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+    (void)!nice(19);
+    int64_t written = -1;
+    if (!over && cpath) {
+        snprintf(file, sizeof(file), "%ld-%d-r%u-sig%d.core%s", t, pid, restarts, sig, ext);
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        lseek(sfd, 0, SEEK_SET);
+        written = coredump_compress(sfd, cpath, dir, file, path, quota);
+        over = written < 0 && raw > quota;
+    }
+    if (!over && written < 0) {
+        /* no compressor, or it failed: keep the core as is */
+        snprintf(file, sizeof(file), "%ld-%d-r%u-sig%d.core", t, pid, restarts, sig);
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        if (coredump_prune(dir, file, quota - raw) + raw <= quota && fchmod(sfd, 0640) == 0 && rename(spool, path) == 0) written = (int64_t)raw;
+        else over = 1;
+    }
+    close(sfd);
+    unlink(spool);
+
+    int kfd = open(KMSG_PATH, O_WRONLY|O_CLOEXEC);
+    if (over) {
+        if (kfd >= 0) dprintf(kfd, "<4>ratos-coredump: %s pid %d signal %d: core exceeds quota of %llu bytes, dropped\n",
+                              name, pid, sig, (unsigned long long)quota);
+    } else if (kfd >= 0) {
+        dprintf(kfd, "<5>ratos-coredump: %s pid %d signal %d restarts %u: %s (%llu bytes)\n",
+                name, pid, sig, restarts, path, (unsigned long long)written);
+    }
+    if (kfd >= 0) close(kfd);
+    return 0;
+}
+
+/*
+ * One pass of the supervise loop: start what is due, wait up to timeout_ms
+ * (less while the next boot batch or a restart backoff is due) for output,
+ * syslog, kmsg or a signal, handle it, then reap and print stats if asked.
+ */
+MAIN_USED static void supervise_once(int timeout_ms) {
+    uint64_t due = start_restarts(), batch = start_pending();
+    if (batch < due) due = batch;
+    if (due != UINT64_MAX) {
+        uint64_t now = clock_usec(CLOCK_MONOTONIC);
+        uint64_t ms = due > now ? (due - now + 999) / 1000 : 0;
+        if (ms < (uint64_t)timeout_ms) timeout_ms = (int)ms;
+    }
+    /* only the entries in use are filled in: MAX_SVC may be large */
+    struct pollfd pfd[4 + MAX_SVC];
+    pfd[0] = (struct pollfd){ .fd = wake_pipe[0], .events = POLLIN };
+    pfd[1] = (struct pollfd){ .fd = syslog_fd, .events = POLLIN };
+    pfd[2] = (struct pollfd){ .fd = kmsg_fd, .events = POLLIN };
+    pfd[3] = (struct pollfd){ .fd = con.len ? con.fd : -1, .events = POLLOUT };
+    service *pfd_svc[4 + MAX_SVC];
+    int npfd = 4;
+    for (int i=0;i<nservices && npfd < 4 + ncapture;i++) {
+        if (services[i].outr < 0) continue;
+        pfd[npfd] = (struct pollfd){ .fd = services[i].outr, .events = POLLIN };
+        pfd_svc[npfd++] = &services[i];
+    }
+    if (sys->poll(pfd, (nfds_t)npfd, timeout_ms) > 0) {
+        char drain[64];
+        if (pfd[0].revents & POLLIN)
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) ;
+        if (pfd[1].revents & POLLIN) handle_syslog();
+        if (pfd[2].revents & POLLIN) handle_kmsg();
+        if (pfd[3].revents & (POLLOUT|POLLERR|POLLHUP)) console_flush();
+        for (int i=4;i<npfd;i++)
+            if (pfd[i].revents & POLLIN) handle_output(pfd_svc[i]);
+    }
+    log_tick();
+    if (need_reap) {
+        need_reap = 0;
+        reap_children();
+    }
+    if (need_stats) {
+        need_stats = 0;
+        print_stats();
     }
 }
 
-/* main */
+/* main; benchmarks include this file with RATOS_INIT_NO_MAIN defined */
+#ifdef RATOS_INIT_NO_MAIN
+/* undo parse_service() for the last service, for programs that parse over
+ * and over (bench/parsebench.c, bench/parsefuzz.c) */
+static inline void unload_last_service(void) {
+    if (nservices == 0) return;
+    service *s = &services[--nservices];
+    free(s->envp);
+    free(s->seccomp);
+    free(s->seg);
+    arena_release(s->loaded);
+    if (main_svc == s) main_svc = NULL;
+}
+#else
 int main(int argc, char **argv) {
-    (void)argc; (void)argv;
+    if (argc > 1 && strcmp(argv[1], "--coredump")==0) return coredump_main(argc, argv);
+    char **cmd = NULL;
+    const char *opt_services = NULL, *opt_log = NULL, *opt_runtime = NULL;
+    for (int i=1;i<argc;i++) {
+        if (strcmp(argv[i], "--container")==0) container_mode = 1;
+        else if (strcmp(argv[i], "--user")==0) user_mode = 1;
+        else if (strcmp(argv[i], "--services-dir")==0 && i+1 < argc) opt_services = argv[++i];
+        else if (strcmp(argv[i], "--log-dir")==0 && i+1 < argc) opt_log = argv[++i];
+        else if (strcmp(argv[i], "--runtime-dir")==0 && i+1 < argc) opt_runtime = argv[++i];
+        else if (strcmp(argv[i], "--")==0) { if (i+1 < argc) cmd = &argv[i+1]; break; }
+    }
+    if (!user_mode && getpid() == 1 && detect_container()) container_mode = 1;
+    /* the system instance has no /proc to reopen stdout through yet */
+    if (container_mode || user_mode) console_open();
+    if (user_mode) user_dirs();
+    if (opt_services) services_dir = opt_services;
+    if (opt_log) log_dir = opt_log;
+    if (opt_runtime) runtime_dir = opt_runtime;
+    if (user_mode) {
+        mkdir_p(services_dir, 0755);
+        mkdir_p(log_dir, 0755);
+        mkdir_p(runtime_dir, 0700);
+        /* orphans of our services come to us rather than to PID 1 */
+        if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) < 0) console_perror("PR_SET_CHILD_SUBREAPER");
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/init.pid", runtime_dir);
+        FILE *f = fopen(path, "w");
+        if (f) { fprintf(f, "%d\n", getpid()); fclose(f); }
+        console(CON_INFO, "user instance: services %s, logs %s", services_dir, log_dir);
+    }
+    if (runtime_dir) snprintf(syslog_path, sizeof(syslog_path), "%s/log", runtime_dir);
+
     /* basic signal handlers */
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = sigchld_handler;
     sigaction(SIGCHLD, &sa, NULL);
     sa.sa_handler = sigterm_handler;
+    if (container_mode) {
+        sa.sa_handler = forward_handler;
+        sigaction(SIGHUP, &sa, NULL);
+        sigaction(SIGUSR1, &sa, NULL);
+        sigaction(SIGUSR2, &sa, NULL);
+    }
     sigaction(SIGTERM, &sa, NULL);
     sigaction(SIGINT, &sa, NULL);
+    if (!container_mode) {
+        sa.sa_handler = sigusr1_handler;
+        sigaction(SIGUSR1, &sa, NULL);
+    }
 
-    /* mount proc/sys if missing */
-    mkdir("/proc",0755); mkdir("/sys",0755); mkdir("/dev",0755);
-    mount("proc","/proc","proc",0,"");
-    mount("sysfs","/sys","sysfs",0,"");
-    mount("devtmpfs","/dev","devtmpfs",0,"");
+    if (!container_mode && !user_mode) {
+        /* mount proc/sys if missing */
+        mkdir("/proc",0755); mkdir("/sys",0755); mkdir("/dev",0755);
+        mount("proc","/proc","proc",0,"");
+        mount("sysfs","/sys","sysfs",0,"");
+        mount("devtmpfs","/dev","devtmpfs",0,"");
+        console_open();
 
-    /* create logdir */
-    mkdir(LOGDIR,0755);
+        /* ratos.* options, as soon as /proc is there to read them */
+        parse_cmdline();
+        if (boot_services_dir && !opt_services) services_dir = boot_services_dir;
+        trace("boot");
 
-    /* load services */
-    load_services();
+        /* only the real init owns the system-wide core_pattern */
+        if (getpid() == 1) setup_coredump();
+    }
 
-    /* start all services */
-    for (int i=0;i<nservices;i++) {
-        start_service(&services[i]);
+    select_scanner();
+
+    if (!container_mode && !user_mode) {
+        /* start collecting kernel messages before anything else can be lost */
+        open_kmsg();
+
+        /* create logdir */
+        mkdir(log_dir,0755);
+
+        /* loads in the background while services are parsed */
+        modules_start();
+    }
+    /* after the kmsg writer thread started, which keeps normal priority */
+    if (!user_mode) protect_self();
+
+    /* wakeup pipe for the main loop, then /dev/log */
+    if (pipe2(wake_pipe, O_NONBLOCK|O_CLOEXEC) < 0) console_perror("pipe2");
+    if (!container_mode) {
+        char path[PATH_MAX];
+        open_syslog();
+        snprintf(path, sizeof(path), "%s/syslog.log", log_dir);
+        syslog_orphan_fd = open(path, O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
     }
 
+    /* load services; a command line replaces any Main=yes service */
+    if (boot_target == TARGET_EMERGENCY) console(CON_INFO, "emergency target: not starting services");
+    else load_services();
+    if (container_mode && cmd) add_main_command(cmd);
+    modules_wait();
+    for (int i=0;i<nservices;i++)
+        debug("loaded %s: %s%s, Restart=%s", services[i].name, services[i].argv ? "" : "sh -c ",
+              services[i].execcmd, services[i].restart == R_ALWAYS ? "always" :
+              services[i].restart == R_ON_FAILURE ? "on-failure" : "no");
+    trace("loaded %d services", nservices);
+    heap_allocs_loaded = heap_allocs;
+
+    /* start all services, or the first ratos.max_parallel= of them */
+    start_pending();
+
     /* spawn getty in a loop (in background) */
-    pid_t getty_pid = fork();
+    pid_t getty_pid = container_mode || user_mode ? -1 : fork();
     if (getty_pid == 0) {
         /* child: spawn a persistent getty loop */
         while (1) {
             pid_t p = fork();
             if (p == 0) {
-                /* child: attach to tty1 and exec login or shell */
-                int fd = open("/dev/tty1", O_RDWR);
+                oom_reset();
+                /* child: attach to tty1 and exec login or shell; rescue and
+                 * emergency targets get a root shell on the console */
+                int fd = open(boot_target == TARGET_DEFAULT ? "/dev/tty1" : "/dev/console", O_RDWR);
                 if (fd >= 0) {
                     dup2(fd,0); dup2(fd,1); dup2(fd,2);
                     if (fd>2) close(fd);
                 }
-                execl("/bin/login","login",(char*)NULL);
+                if (boot_target == TARGET_DEFAULT) execl("/bin/login","login",(char*)NULL);
                 execl("/bin/sh","sh","-l",(char*)NULL);
                 _exit(127);
             }
@@ -265,23 +3251,25 @@ int main(int argc, char **argv) {
     }
 
     /* main supervise loop */
-    while (!terminate) {
-        if (need_reap) {
-            need_reap = 0;
-            /* reap all children */
-            int status;
-            pid_t pid;
-            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-                handle_reaped(pid, status);
-            }
-        }
-        /* periodic work */
-        sleep(1);
-    }
+    while (!terminate) supervise_once(1000);
 
     /* termination: stop services */
-    printf("[init] shutting down services\n");
+    console(CON_INFO, "shutting down services");
     for (int i=0;i<nservices;i++) stop_service(&services[i]);
+    for (int i=0;i<nservices;i++) if (services[i].outr >= 0) handle_output(&services[i]);
+    for (int i=0;i<nservices;i++) if (services[i].structured) log_seg_close(&services[i]);
+    klog_stop();
+    console_drain(1000);
+
+    /* a container's exit status is its main service's */
+    if (container_mode) return main_status;
+    if (user_mode) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/init.pid", runtime_dir);
+        unlink(path);
+        unlink(syslog_path);
+        return 0;
+    }
 
     /* try to sync and poweroff (if present) */
     sync();
@@ -289,4 +3277,5 @@ int main(int argc, char **argv) {
         execl("/sbin/poweroff", "poweroff", NULL);
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,177 @@
+/* logindex.h - sidecar index of RatOS service logs
+ *
+ * Next to every /var/log/<name>.log written by init there is a
+ * <name>.log.idx holding an array of log_index_entry, appended whenever
+ * another LOG_INDEX_STRIDE bytes of log have been written. Entries are in
+ * file order, and since init timestamps lines as it receives them, also in
+ * time order, so a reader can binary-search for a time range and read only
+ * that part of the log.
+ *
+ * Services in structured mode additionally get, per index block (segment):
+ *   <name>.log.seg   array of log_seg_entry: byte range, bloom filter of
+ *                    every key=value in the segment, and where its columns are
+ *   <name>.log.cols  one column block per segment:
+ *                      log_cols_hdr
+ *                      uint32_t row_off[nrows]    line offset - log_offset
+ *                      ncols times:
+ *                        uint16_t klen, key bytes,
+ *                        uint16_t vlen[nrows]     LOG_COL_ABSENT if missing
+ *                        value bytes, concatenated
+ * A segment whose rows did not fit in init's buffers has nrows == 0 and no
+ * column block; readers then parse the lines themselves.
+ */
+#ifndef RATOS_LOGINDEX_H
+#define RATOS_LOGINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define LOG_INDEX_STRIDE (64*1024)
+
+typedef struct log_index_entry {
+    uint64_t offset;     /* byte offset of the first line of the block */
+    uint64_t usec;       /* its receive time, CLOCK_REALTIME microseconds */
+} log_index_entry;
+
+#define LOG_BLOOM_BYTES 2048
+#define LOG_BLOOM_K 4
+#define LOG_COLS_MAGIC 0x31434c52   /* "RLC1" */
+#define LOG_COL_ABSENT 0xffff
+#define LOG_FIELDS_MAX 16
+
+typedef struct log_seg_entry {
+    uint64_t log_offset;      /* segment is [log_offset, log_end) of the log */
+    uint64_t log_end;
+    uint64_t cols_offset;     /* column block in .cols */
+    uint32_t cols_size;       /* 0: no column block */
+    uint32_t nrows;
+    uint8_t bloom[LOG_BLOOM_BYTES];
+} log_seg_entry;
+
+typedef struct log_cols_hdr {
+    uint32_t magic;
+    uint32_t nrows;
+    uint32_t ncols;
+    uint32_t size;            /* whole block, header included */
+    uint64_t log_offset;
+} log_cols_hdr;
+
+typedef struct log_field {
+    const char *key, *val;
+    uint16_t klen, vlen;
+} log_field;
+
+static inline uint64_t log_hash(const char *p, size_t len, uint64_t h) {
+    for (size_t i=0;i<len;i++) { h ^= (unsigned char)p[i]; h *= 0x100000001b3ULL; }
+    return h;
+}
+
+/* FNV-1a of "key=value", split into two halves for double hashing */
+static inline uint64_t log_field_hash(const char *k, size_t klen, const char *v, size_t vlen) {
+    uint64_t h = log_hash(k, klen, 0xcbf29ce484222325ULL);
+    h = log_hash("=", 1, h);
+    return log_hash(v, vlen, h);
+}
+
+static inline void log_bloom_add(uint8_t *bloom, uint64_t h) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i=0;i<LOG_BLOOM_K;i++) {
+        uint32_t bit = (h1 + i * h2) % (LOG_BLOOM_BYTES * 8);
+        bloom[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    }
+}
+
+static inline int log_bloom_test(const uint8_t *bloom, uint64_t h) {
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i=0;i<LOG_BLOOM_K;i++) {
+        uint32_t bit = (h1 + i * h2) % (LOG_BLOOM_BYTES * 8);
+        if (!(bloom[bit >> 3] & (1u << (bit & 7)))) return 0;
+    }
+    return 1;
+}
+
+static inline int log_key_char(char c) {
+    return (c>='a'&&c<='z') || (c>='A'&&c<='Z') || (c>='0'&&c<='9') || c=='_' || c=='.' || c=='-';
+}
+
+/*
+ * Fields of one line. Two formats are understood:
+ *   logfmt:  free text with key=value or key="quoted value" tokens
+ *   JSON:    a flat {"key": "value", "n": 1} object; nested values are skipped
+ * Values are returned as they appear, without quotes or unescaping.
+ */
+static inline int log_parse_fields(const char *p, size_t len, log_field *f, int max) {
+    const char *end = p + len;
+    int n = 0;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p < end && *p == '{') {
+        p++;
+        while (p < end && n < max) {
+            while (p < end && (*p == ' ' || *p == ',' || *p == '\t')) p++;
+            if (p >= end || *p != '"') break;
+            const char *k = ++p;
+            while (p < end && *p != '"') p += (*p == '\\') ? 2 : 1;
+            if (p >= end) break;
+            size_t klen = (size_t)(p - k);
+            p++;
+            while (p < end && (*p == ' ' || *p == ':')) p++;
+            if (p >= end) break;
+            const char *v;
+            size_t vlen;
+            if (*p == '"') {
+                v = ++p;
+                while (p < end && *p != '"') p += (*p == '\\') ? 2 : 1;
+                if (p > end) p = end;
+                vlen = (size_t)(p - v);
+                if (p < end) p++;
+            } else if (*p == '{' || *p == '[') {
+                int depth = 0;
+                do {
+                    if (*p == '{' || *p == '[') depth++;
+                    else if (*p == '}' || *p == ']') depth--;
+                    p++;
+                } while (p < end && depth);
+                continue;
+            } else {
+                v = p;
+                while (p < end && *p != ',' && *p != '}' && *p != ' ') p++;
+                vlen = (size_t)(p - v);
+            }
+            if (klen > 0xfffe || vlen > 0xfffe) continue;
+            f[n].key = k; f[n].klen = (uint16_t)klen;
+            f[n].val = v; f[n].vlen = (uint16_t)vlen;
+            n++;
+        }
+        return n;
+    }
+    while (p < end && n < max) {
+        while (p < end && *p == ' ') p++;
+        const char *k = p;
+        while (p < end && log_key_char(*p)) p++;
+        if (p == k || p >= end || *p != '=') {
+            while (p < end && *p != ' ') p++;   /* not a field: skip the word */
+            continue;
+        }
+        size_t klen = (size_t)(p - k);
+        const char *v = ++p;
+        size_t vlen;
+        if (p < end && *p == '"') {
+            v = ++p;
+            while (p < end && *p != '"') p += (*p == '\\') ? 2 : 1;
+            if (p > end) p = end;
+            vlen = (size_t)(p - v);
+            if (p < end) p++;
+        } else {
+            while (p < end && *p != ' ') p++;
+            vlen = (size_t)(p - v);
+        }
+        if (klen > 0xfffe || vlen > 0xfffe) continue;
+        f[n].key = k; f[n].klen = (uint16_t)klen;
+        f[n].val = v; f[n].vlen = (uint16_t)vlen;
+        n++;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,334 @@
+/* ratos-log.c - time range queries over RatOS service logs
+ *
+ * Build:
+ *   gcc -static -O2 -o ratos-log ratos-log.c
+ *
+ * Usage:
+ *   ratos-log [--service NAME] [--since TIME] [--until TIME]
+ *             [--field KEY=VALUE] [--dir DIR]
+ *
+ * TIME is "YYYY-MM-DD HH:MM:SS", "YYYY-MM-DDTHH:MM:SS", "@<epoch>" or
+ * relative to now as "-<n>s", "-<n>m", "-<n>h", "-<n>d"; all in UTC, like
+ * the timestamps init writes. Without --service every log in DIR (default
+ * /var/log) that has an index is queried and lines are prefixed with the
+ * service name.
+ *
+ * The <name>.log.idx sidecar (see logindex.h) is binary-searched for the
+ * first and last block that can hold matching lines, and only that part of
+ * the log is mapped and scanned. With --field, segments of structured logs
+ * whose bloom filter rules the value out are skipped without being read,
+ * and the remaining ones are answered from the column file where possible.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "logindex.h"
+
+#define LOGDIR "/var/log"
+#define TS_LEN 27            /* "2026-10-17T15:50:56.123456Z" */
+
+static uint64_t since = 0, until = UINT64_MAX;
+static const char *field_key, *field_val;   /* --field, NULL if not given */
+static size_t field_klen, field_vlen;
+static uint64_t field_hash;
+
+/* parse the timestamp at the start of a log line; 0 if there is none */
+static uint64_t line_time(const char *p, size_t len) {
+    if (len < TS_LEN || p[4] != '-' || p[10] != 'T' || p[19] != '.' || p[26] != 'Z') return 0;
+    static char last_date[19];
+    static time_t last_sec;
+    if (memcmp(p, last_date, 19) != 0) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!strptime(p, "%Y-%m-%dT%H:%M:%S", &tm)) return 0;
+        last_sec = timegm(&tm);
+        memcpy(last_date, p, 19);
+    }
+    uint64_t us = 0;
+    for (int i=20;i<26;i++) {
+        if (p[i] < '0' || p[i] > '9') return 0;
+        us = us * 10 + (uint64_t)(p[i] - '0');
+    }
+    return (uint64_t)last_sec * 1000000 + us;
+}
+
+static int parse_time(const char *s, uint64_t *out) {
+    char *end;
+    if (s[0] == '@') {
+        *out = (uint64_t)strtoull(s+1, &end, 10) * 1000000;
+        return *end == 0;
+    }
+    if (s[0] == '-') {
+        unsigned long long n = strtoull(s+1, &end, 10);
+        unsigned long long mul = 1;
+        switch (*end) {
+        case 's': case 0: mul = 1; break;
+        case 'm': mul = 60; break;
+        case 'h': mul = 3600; break;
+        case 'd': mul = 86400; break;
+        default: return 0;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        *out = ((uint64_t)ts.tv_sec - n * mul) * 1000000;
+        return 1;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%d", &tm);
+    if (!end) return 0;
+    if (*end == ' ' || *end == 'T') {
+        end = strptime(end+1, "%H:%M:%S", &tm);
+        if (!end) return 0;
+    }
+    if (*end == 'Z') end++;
+    if (*end) return 0;
+    *out = (uint64_t)timegm(&tm) * 1000000;
+    return 1;
+}
+
+/* byte range [*from, *to) of the log that can contain lines in the window */
+static void index_range(const char *idxpath, uint64_t size, uint64_t *from, uint64_t *to) {
+    *from = 0;
+    *to = size;
+    int fd = open(idxpath, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    size_t n = 0;
+    if (fstat(fd, &st) == 0) n = (size_t)st.st_size / sizeof(log_index_entry);
+    if (n == 0) { close(fd); return; }
+    const log_index_entry *e = mmap(NULL, n * sizeof(*e), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (e == MAP_FAILED) return;
+
+    /* last block starting at or before since */
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[mid].usec <= since) lo = mid + 1; else hi = mid;
+    }
+    if (lo > 0 && e[lo-1].offset <= size) *from = e[lo-1].offset;
+
+    /* first block starting after until */
+    lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[mid].usec <= until) lo = mid + 1; else hi = mid;
+    }
+    if (lo < n && e[lo].offset < *to) *to = e[lo].offset;
+    munmap((void*)e, n * sizeof(*e));
+}
+
+static void print_line(const char *name, int prefix, const char *p, size_t len) {
+    if (prefix) {
+        fputs(name, stdout);
+        fputs(": ", stdout);
+    }
+    fwrite(p, 1, len, stdout);
+}
+
+/* does the line carry --field? The timestamp prefix is not part of it. */
+static int line_has_field(const char *p, size_t len) {
+    if (len && p[len-1] == '\n') len--;
+    if (line_time(p, len) && len > TS_LEN) { p += TS_LEN + 1; len -= TS_LEN + 1; }
+    log_field f[LOG_FIELDS_MAX];
+    int n = log_parse_fields(p, len, f, LOG_FIELDS_MAX);
+    for (int i=0;i<n;i++)
+        if (f[i].klen == field_klen && f[i].vlen == field_vlen &&
+            memcmp(f[i].key, field_key, field_klen) == 0 && memcmp(f[i].val, field_val, field_vlen) == 0)
+            return 1;
+    return 0;
+}
+
+/* print matching lines of [p, end); returns 1 once a line past --until is seen */
+static int scan(const char *name, int prefix, const char *p, const char *end) {
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *next = nl ? nl + 1 : end;
+        size_t len = (size_t)(next - p);
+        uint64_t t = line_time(p, len);
+        if (t && t > until) return 1;
+        if ((t == 0 ? since == 0 : t >= since) && (!field_key || line_has_field(p, len)))
+            print_line(name, prefix, p, len);
+        p = next;
+    }
+    return 0;
+}
+
+/* print the rows of one segment's column block whose --field matches;
+ * returns -1 if the block is unusable and the caller should scan instead */
+static int scan_columns(const char *name, int prefix, int colfd, const log_seg_entry *e,
+                        const char *map, uint64_t base, uint64_t from, uint64_t to) {
+    char *blk = malloc(e->cols_size);
+    if (!blk) return -1;
+    const log_cols_hdr *h = (const log_cols_hdr*)blk;
+    if (pread(colfd, blk, e->cols_size, (off_t)e->cols_offset) != (ssize_t)e->cols_size ||
+        h->magic != LOG_COLS_MAGIC || h->size != e->cols_size || h->log_offset != e->log_offset) {
+        free(blk);
+        return -1;
+    }
+    const char *end = blk + h->size;
+    const uint32_t *row_off = (const uint32_t*)(blk + sizeof(*h));
+    const char *p = (const char*)(row_off + h->nrows);
+    for (uint32_t c=0;c<h->ncols && p + 2 <= end;c++) {
+        uint16_t klen;
+        memcpy(&klen, p, 2);
+        const char *key = p + 2;
+        const char *vlens = key + klen;
+        const char *vals = vlens + 2 * (size_t)h->nrows;
+        if (vals > end) break;
+        int want = klen == field_klen && memcmp(key, field_key, klen) == 0;
+        for (uint32_t r=0;r<h->nrows;r++) {
+            uint16_t vlen;
+            memcpy(&vlen, vlens + 2 * (size_t)r, 2);
+            if (vlen == LOG_COL_ABSENT) continue;
+            if (vals + vlen > end) break;
+            uint64_t off = e->log_offset + row_off[r];
+            if (want && vlen == field_vlen && memcmp(vals, field_val, vlen) == 0 && off >= from && off < to) {
+                const char *line = map + (off - base), *mend = map + (to - base);
+                const char *nl = memchr(line, '\n', (size_t)(mend - line));
+                size_t len = nl ? (size_t)(nl + 1 - line) : (size_t)(mend - line);
+                uint64_t t = line_time(line, len);
+                if (t == 0 ? since == 0 : (t >= since && t <= until)) print_line(name, prefix, line, len);
+            }
+            vals += vlen;
+        }
+        if (want) break;
+        p = vals;
+    }
+    free(blk);
+    return 0;
+}
+
+/* --field over [from, to): use the segment records of a structured log */
+static void query_field(const char *path, const char *name, int prefix,
+                        const char *map, uint64_t base, uint64_t from, uint64_t to) {
+    char segpath[520], colpath[520];
+    snprintf(segpath, sizeof(segpath), "%s.seg", path);
+    snprintf(colpath, sizeof(colpath), "%s.cols", path);
+    const log_seg_entry *segs = NULL;
+    size_t nsegs = 0;
+    int fd = open(segpath, O_RDONLY|O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) nsegs = (size_t)st.st_size / sizeof(log_seg_entry);
+        if (nsegs) segs = mmap(NULL, nsegs * sizeof(*segs), PROT_READ, MAP_SHARED, fd, 0);
+        if (segs == MAP_FAILED) { segs = NULL; nsegs = 0; }
+        close(fd);
+    }
+    int colfd = open(colpath, O_RDONLY|O_CLOEXEC);
+
+    uint64_t pos = from;
+    for (size_t i=0;i<nsegs;i++) {
+        const log_seg_entry *e = &segs[i];
+        if (e->log_end <= pos) continue;
+        if (e->log_offset >= to) break;
+        if (e->log_offset > pos) {
+            if (scan(name, prefix, map + (pos - base), map + (e->log_offset - base))) goto out;
+            pos = e->log_offset;
+        }
+        uint64_t segend = e->log_end < to ? e->log_end : to;
+        if (!log_bloom_test(e->bloom, field_hash)) { pos = segend; continue; }
+        if (!e->cols_size || colfd < 0 || scan_columns(name, prefix, colfd, e, map, base, pos, segend) < 0)
+            if (scan(name, prefix, map + (pos - base), map + (segend - base))) goto out;
+        pos = segend;
+    }
+    scan(name, prefix, map + (pos - base), map + (to - base));
+out:
+    if (colfd >= 0) close(colfd);
+    if (segs) munmap((void*)segs, nsegs * sizeof(*segs));
+}
+
+/* print the lines of one log that fall inside the window */
+static int query(const char *dir, const char *name, int prefix) {
+    char path[512], idxpath[520];
+    snprintf(path, sizeof(path), "%s/%s.log", dir, name);
+    snprintf(idxpath, sizeof(idxpath), "%s.idx", path);
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) { perror(path); return 1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) { close(fd); return 0; }
+
+    uint64_t from, to;
+    index_range(idxpath, (uint64_t)st.st_size, &from, &to);
+    if (from >= to) { close(fd); return 0; }
+    uint64_t pg = (uint64_t)sysconf(_SC_PAGESIZE);
+    /* map from the byte before `from` too, for the line-start check below */
+    uint64_t base = (from ? from - 1 : 0) & ~(pg - 1);
+    size_t maplen = (size_t)(to - base);
+    char *map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, (off_t)base);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return 1; }
+
+    const char *p = map + (from - base);
+    /* raw (spliced) logs may be indexed mid-line */
+    if (from > 0 && p[-1] != '\n') {
+        const char *nl = memchr(p, '\n', (size_t)(map + maplen - p));
+        from = nl ? (uint64_t)(nl + 1 - map) + base : to;
+    }
+    if (field_key) {
+        query_field(path, name, prefix, map, base, from, to);
+    } else {
+        madvise(map, maplen, MADV_SEQUENTIAL);
+        scan(name, prefix, map + (from - base), map + maplen);
+    }
+    munmap(map, maplen);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: ratos-log [--service NAME] [--since TIME] [--until TIME]\n"
+                    "                 [--field KEY=VALUE] [--dir DIR]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = LOGDIR, *service = NULL;
+    for (int i=1;i<argc;i++) {
+        if (i+1 >= argc) usage();
+        if (strcmp(argv[i],"--service")==0) service = argv[++i];
+        else if (strcmp(argv[i],"--dir")==0) dir = argv[++i];
+        else if (strcmp(argv[i],"--since")==0) { if (!parse_time(argv[++i], &since)) usage(); }
+        else if (strcmp(argv[i],"--until")==0) {
+            if (!parse_time(argv[++i], &until)) usage();
+            until += 999999;   /* TIME has whole seconds; include that second */
+        }
+        else if (strcmp(argv[i],"--field")==0) {
+            field_key = argv[++i];
+            char *eq = strchr(field_key, '=');
+            if (!eq || eq == field_key) usage();
+            field_klen = (size_t)(eq - field_key);
+            field_val = eq + 1;
+            field_vlen = strlen(field_val);
+            field_hash = log_field_hash(field_key, field_klen, field_val, field_vlen);
+        }
+        else usage();
+    }
+    static char obuf[65536];
+    setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+    if (service) return query(dir, service, 0);
+
+    DIR *d = opendir(dir);
+    if (!d) { perror(dir); return 1; }
+    int rc = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        size_t len = strlen(e->d_name);
+        if (len < 9 || strcmp(e->d_name + len - 8, ".log.idx") != 0) continue;
+        e->d_name[len - 8] = 0;
+        rc |= query(dir, e->d_name, 1);
+    }
+    closedir(d);
+    return rc;
+}
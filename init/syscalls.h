@@ -0,0 +1,235 @@
+/* syscalls.h - system call names and groups for SystemCallFilter=
+ *
+ * syscall_names maps the names accepted in service files to this
+ * architecture's numbers; syscall_groups gives the "@group" names, whose
+ * members may themselves be groups. Only x86_64 and aarch64 are covered.
+ * Calls an architecture does not have are numbered -1 and ignored.
+ */
+#ifndef RATOS_SYSCALLS_H
+#define RATOS_SYSCALLS_H
+
+#include <sys/syscall.h>
+#include <linux/audit.h>
+
+#if defined(__x86_64__)
+#define SYSCALL_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SYSCALL_AUDIT_ARCH AUDIT_ARCH_AARCH64
+/* older calls that asm-generic architectures never had */
+#define __NR__sysctl -1
+#define __NR_access -1
+#define __NR_afs_syscall -1
+#define __NR_alarm -1
+#define __NR_arch_prctl -1
+#define __NR_chmod -1
+#define __NR_chown -1
+#define __NR_creat -1
+#define __NR_create_module -1
+#define __NR_dup2 -1
+#define __NR_epoll_create -1
+#define __NR_epoll_wait -1
+#define __NR_eventfd -1
+#define __NR_fork -1
+#define __NR_futimesat -1
+#define __NR_get_kernel_syms -1
+#define __NR_get_thread_area -1
+#define __NR_getdents -1
+#define __NR_getpgrp -1
+#define __NR_getpmsg -1
+#define __NR_inotify_init -1
+#define __NR_ioperm -1
+#define __NR_iopl -1
+#define __NR_lchown -1
+#define __NR_link -1
+#define __NR_lstat -1
+#define __NR_mkdir -1
+#define __NR_mknod -1
+#define __NR_open -1
+#define __NR_pause -1
+#define __NR_pipe -1
+#define __NR_poll -1
+#define __NR_putpmsg -1
+#define __NR_query_module -1
+#define __NR_readlink -1
+#define __NR_rename -1
+#define __NR_rmdir -1
+#define __NR_security -1
+#define __NR_select -1
+#define __NR_set_thread_area -1
+#define __NR_signalfd -1
+#define __NR_stat -1
+#define __NR_symlink -1
+#define __NR_sysfs -1
+#define __NR_time -1
+#define __NR_tuxcall -1
+#define __NR_unlink -1
+#define __NR_uselib -1
+#define __NR_ustat -1
+#define __NR_utime -1
+#define __NR_utimes -1
+#define __NR_vfork -1
+#define __NR_vserver -1
+#endif
+
+#ifdef SYSCALL_AUDIT_ARCH
+
+#define SC(n) { #n, __NR_##n }
+static const struct syscall_name { const char *name; int nr; } syscall_names[] = {
+    SC(_sysctl), SC(accept), SC(accept4), SC(access), SC(acct), SC(add_key),
+    SC(adjtimex), SC(afs_syscall), SC(alarm), SC(arch_prctl), SC(bind),
+    SC(bpf), SC(brk), SC(capget), SC(capset), SC(chdir), SC(chmod), SC(chown),
+    SC(chroot), SC(clock_adjtime), SC(clock_getres), SC(clock_gettime),
+    SC(clock_nanosleep), SC(clock_settime), SC(clone), SC(clone3), SC(close),
+    SC(close_range), SC(connect), SC(creat), SC(create_module),
+    SC(delete_module), SC(dup), SC(dup2), SC(dup3), SC(epoll_create),
+    SC(epoll_create1), SC(epoll_ctl), SC(epoll_pwait), SC(epoll_pwait2),
+    SC(epoll_wait), SC(eventfd), SC(eventfd2), SC(execve), SC(execveat),
+    SC(exit), SC(exit_group), SC(faccessat), SC(faccessat2), SC(fadvise64),
+    SC(fallocate), SC(fanotify_init), SC(fchdir), SC(fchmod), SC(fchmodat),
+    SC(fchown), SC(fchownat), SC(fcntl), SC(fdatasync), SC(fgetxattr),
+    SC(finit_module), SC(flistxattr), SC(flock), SC(fork), SC(fremovexattr),
+    SC(fsconfig), SC(fsetxattr), SC(fsmount), SC(fsopen), SC(fspick),
+    SC(fstat), SC(fstatfs), SC(fsync), SC(ftruncate), SC(futex),
+    SC(futex_waitv), SC(futimesat), SC(get_kernel_syms), SC(get_mempolicy),
+    SC(get_robust_list), SC(get_thread_area), SC(getcwd), SC(getdents),
+    SC(getdents64), SC(getegid), SC(geteuid), SC(getgid), SC(getitimer),
+    SC(getpeername), SC(getpgid), SC(getpgrp), SC(getpid), SC(getpmsg),
+    SC(getppid), SC(getpriority), SC(getrandom), SC(getresgid), SC(getresuid),
+    SC(getrlimit), SC(getrusage), SC(getsid), SC(getsockname), SC(getsockopt),
+    SC(gettid), SC(gettimeofday), SC(getuid), SC(getxattr), SC(init_module),
+    SC(inotify_add_watch), SC(inotify_init), SC(inotify_init1),
+    SC(inotify_rm_watch), SC(ioctl), SC(ioperm), SC(iopl), SC(ioprio_get),
+    SC(ioprio_set), SC(kexec_file_load), SC(kexec_load), SC(keyctl), SC(kill),
+    SC(lchown), SC(lgetxattr), SC(link), SC(linkat), SC(listen),
+    SC(listxattr), SC(llistxattr), SC(lremovexattr), SC(lseek), SC(lsetxattr),
+    SC(lstat), SC(madvise), SC(mbind), SC(membarrier), SC(memfd_create),
+    SC(migrate_pages), SC(mkdir), SC(mkdirat), SC(mknod), SC(mknodat),
+    SC(mlock), SC(mlock2), SC(mmap), SC(mount), SC(mount_setattr),
+    SC(move_mount), SC(move_pages), SC(mprotect), SC(mq_getsetattr),
+    SC(mq_notify), SC(mq_open), SC(mq_timedreceive), SC(mq_timedsend),
+    SC(mq_unlink), SC(mremap), SC(msgctl), SC(msgget), SC(msgrcv), SC(msgsnd),
+    SC(msync), SC(munlock), SC(munmap), SC(name_to_handle_at), SC(nanosleep),
+    SC(newfstatat), SC(open), SC(open_by_handle_at), SC(open_tree),
+    SC(openat), SC(openat2), SC(pause), SC(perf_event_open), SC(pidfd_getfd),
+    SC(pidfd_open), SC(pidfd_send_signal), SC(pipe), SC(pipe2),
+    SC(pivot_root), SC(poll), SC(ppoll), SC(prctl), SC(pread64), SC(preadv),
+    SC(preadv2), SC(prlimit64), SC(process_madvise), SC(process_vm_readv),
+    SC(process_vm_writev), SC(pselect6), SC(ptrace), SC(putpmsg),
+    SC(pwrite64), SC(pwritev), SC(pwritev2), SC(query_module), SC(quotactl),
+    SC(read), SC(readlink), SC(readlinkat), SC(readv), SC(reboot),
+    SC(recvfrom), SC(recvmmsg), SC(recvmsg), SC(removexattr), SC(rename),
+    SC(renameat), SC(renameat2), SC(request_key), SC(restart_syscall),
+    SC(rmdir), SC(rseq), SC(rt_sigaction), SC(rt_sigpending),
+    SC(rt_sigprocmask), SC(rt_sigqueueinfo), SC(rt_sigreturn),
+    SC(rt_sigsuspend), SC(rt_sigtimedwait), SC(rt_tgsigqueueinfo),
+    SC(sched_get_priority_max), SC(sched_get_priority_min),
+    SC(sched_getaffinity), SC(sched_getattr), SC(sched_getparam),
+    SC(sched_getscheduler), SC(sched_rr_get_interval), SC(sched_setaffinity),
+    SC(sched_setattr), SC(sched_setparam), SC(sched_setscheduler),
+    SC(sched_yield), SC(security), SC(select), SC(semctl), SC(semget),
+    SC(semop), SC(semtimedop), SC(sendfile), SC(sendmmsg), SC(sendmsg),
+    SC(sendto), SC(set_mempolicy), SC(set_robust_list), SC(set_thread_area),
+    SC(set_tid_address), SC(setdomainname), SC(setfsgid), SC(setfsuid),
+    SC(setgid), SC(setgroups), SC(sethostname), SC(setitimer), SC(setns),
+    SC(setpgid), SC(setpriority), SC(setregid), SC(setresgid), SC(setresuid),
+    SC(setreuid), SC(setrlimit), SC(setsid), SC(setsockopt), SC(settimeofday),
+    SC(setuid), SC(setxattr), SC(shmat), SC(shmctl), SC(shmdt), SC(shmget),
+    SC(shutdown), SC(sigaltstack), SC(signalfd), SC(signalfd4), SC(socket),
+    SC(socketpair), SC(splice), SC(stat), SC(statfs), SC(statx), SC(swapoff),
+    SC(swapon), SC(symlink), SC(symlinkat), SC(sync_file_range), SC(sysfs),
+    SC(sysinfo), SC(tee), SC(tgkill), SC(time), SC(timer_create),
+    SC(timer_delete), SC(timer_getoverrun), SC(timer_gettime),
+    SC(timer_settime), SC(timerfd_create), SC(timerfd_gettime),
+    SC(timerfd_settime), SC(times), SC(tkill), SC(truncate), SC(tuxcall),
+    SC(umask), SC(umount2), SC(uname), SC(unlink), SC(unlinkat), SC(unshare),
+    SC(uselib), SC(ustat), SC(utime), SC(utimensat), SC(utimes), SC(vfork),
+    SC(vhangup), SC(vmsplice), SC(vserver), SC(wait4), SC(waitid), SC(write),
+    SC(writev),
+};
+#undef SC
+
+static const struct syscall_group { const char *name, *calls; } syscall_groups[] = {
+    { "@default",
+      "arch_prctl brk clock_getres clock_gettime clock_nanosleep execve "
+      "execveat exit exit_group futex futex_waitv get_robust_list "
+      "get_thread_area getegid geteuid getgid getpgrp getpid getppid "
+      "getrandom getresgid getresuid getrlimit gettid gettimeofday getuid "
+      "membarrier mmap mprotect munmap nanosleep pause prlimit64 "
+      "restart_syscall rseq rt_sigreturn sched_getaffinity sched_yield "
+      "set_robust_list set_thread_area set_tid_address time" },
+    { "@basic-io",
+      "close close_range dup dup2 dup3 lseek pread64 preadv preadv2 "
+      "pwrite64 pwritev pwritev2 read readv write writev" },
+    { "@file-system",
+      "access chdir chmod close creat faccessat faccessat2 fallocate "
+      "fchdir fchmod fchmodat fcntl fgetxattr flistxattr fremovexattr "
+      "fsetxattr fstat fstatfs ftruncate futimesat getcwd getdents "
+      "getdents64 getxattr inotify_add_watch inotify_init inotify_init1 "
+      "inotify_rm_watch lgetxattr link linkat listxattr llistxattr "
+      "lremovexattr lsetxattr lstat mkdir mkdirat mknod mknodat mmap "
+      "munmap newfstatat open openat openat2 readlink readlinkat "
+      "removexattr rename renameat renameat2 rmdir setxattr stat statfs "
+      "statx symlink symlinkat truncate unlink unlinkat utime utimensat "
+      "utimes" },
+    { "@io-event",
+      "epoll_create epoll_create1 epoll_ctl epoll_pwait epoll_pwait2 "
+      "epoll_wait eventfd eventfd2 poll ppoll pselect6 select" },
+    { "@ipc",
+      "memfd_create mq_getsetattr mq_notify mq_open mq_timedreceive "
+      "mq_timedsend mq_unlink msgctl msgget msgrcv msgsnd pipe pipe2 "
+      "process_madvise process_vm_readv process_vm_writev semctl semget "
+      "semop semtimedop shmat shmctl shmdt shmget" },
+    { "@network-io",
+      "accept accept4 bind connect getpeername getsockname getsockopt "
+      "listen recvfrom recvmmsg recvmsg sendmmsg sendmsg sendto "
+      "setsockopt shutdown socket socketpair" },
+    { "@process",
+      "capget clone clone3 execveat fork getrusage kill pidfd_getfd "
+      "pidfd_open pidfd_send_signal prctl rt_sigqueueinfo "
+      "rt_tgsigqueueinfo setns tgkill times tkill unshare vfork wait4 "
+      "waitid" },
+    { "@signal",
+      "rt_sigaction rt_sigpending rt_sigprocmask rt_sigsuspend "
+      "rt_sigtimedwait sigaltstack signalfd signalfd4" },
+    { "@timer",
+      "alarm getitimer setitimer timer_create timer_delete "
+      "timer_getoverrun timer_gettime timer_settime timerfd_create "
+      "timerfd_gettime timerfd_settime times" },
+    { "@setuid",
+      "setfsgid setfsuid setgid setgroups setregid setresgid setresuid "
+      "setreuid setuid" },
+    { "@chown", "chown fchown fchownat lchown" },
+    { "@mount",
+      "chroot fsconfig fsmount fsopen fspick mount mount_setattr "
+      "move_mount open_tree pivot_root umount2" },
+    { "@module", "delete_module finit_module init_module" },
+    { "@reboot", "kexec_file_load kexec_load reboot" },
+    { "@swap", "swapoff swapon" },
+    { "@clock", "adjtimex clock_adjtime clock_settime settimeofday" },
+    { "@raw-io", "ioperm iopl" },
+    { "@debug", "perf_event_open ptrace" },
+    { "@keyring", "add_key keyctl request_key" },
+    { "@resources",
+      "ioprio_set mbind migrate_pages move_pages sched_setaffinity "
+      "sched_setattr sched_setparam sched_setscheduler set_mempolicy "
+      "setpriority setrlimit" },
+    { "@obsolete",
+      "_sysctl afs_syscall create_module get_kernel_syms getpmsg putpmsg "
+      "query_module security sysfs tuxcall uselib ustat vserver" },
+    { "@system-service",
+      "@default @basic-io @file-system @io-event @ipc @network-io "
+      "@process @signal @timer @setuid @chown capset fadvise64 fdatasync "
+      "flock fsync get_mempolicy getpgid getpriority getsid ioctl "
+      "ioprio_get madvise mlock mlock2 mremap msync munlock "
+      "name_to_handle_at sched_get_priority_max sched_get_priority_min "
+      "sched_getattr sched_getparam sched_getscheduler "
+      "sched_rr_get_interval sendfile setpgid setsid splice "
+      "sync_file_range sysinfo tee umask uname vmsplice" },
+    { "@privileged",
+      "@chown @clock @module @raw-io @reboot @swap @setuid _sysctl acct "
+      "bpf capset chroot fanotify_init open_by_handle_at pivot_root "
+      "quotactl setdomainname sethostname vhangup" },
+};
+
+#endif /* SYSCALL_AUDIT_ARCH */
+#endif